@@ -0,0 +1,142 @@
+//
+// async_file.cc
+//
+// C++20 coroutine interface to File.
+//
+
+
+#include "async_file.h"
+#include "file.h"
+
+#include <exception>
+#include <string.h>	// memchr
+
+
+std::suspend_never Task::promise_type::final_suspend() noexcept {
+  if (this->io != nullptr) this->io->finished();
+  return {};
+}
+
+
+void Task::promise_type::unhandled_exception() {
+  std::terminate();
+}
+
+
+Task::~Task() {
+  if (this->handle) this->handle.destroy();	// Never spawned
+}
+
+
+AsyncIo::AsyncIo(int threads) {
+  for (int i = 0; i < threads; i++)
+    this->pool.emplace_back(&AsyncIo::work, this);
+}
+
+
+AsyncIo::~AsyncIo() {
+  {
+    std::lock_guard<std::mutex> lock(this->jobLock);
+    this->stopping = true;
+  }
+  this->jobCond.notify_all();
+  for (std::thread &t : this->pool) t.join();
+}
+
+
+void AsyncIo::spawn(Task task) {
+  task.handle.promise().io = this;
+  {
+    std::lock_guard<std::mutex> lock(this->readyLock);
+    this->live++;
+  }
+  this->post(task.handle);
+  task.handle = nullptr;
+}
+
+
+void AsyncIo::post(std::coroutine_handle<> h) {
+  {
+    std::lock_guard<std::mutex> lock(this->readyLock);
+    this->readyQueue.push_back(h);
+  }
+  this->readyCond.notify_one();
+}
+
+
+// Called from a task's final suspend point, on the run() thread.
+void AsyncIo::finished() {
+  std::lock_guard<std::mutex> lock(this->readyLock);
+  this->live--;
+}
+
+
+void AsyncIo::run() {
+  std::deque<std::coroutine_handle<>> batch;
+  std::unique_lock<std::mutex> lock(this->readyLock);
+  while (this->live > 0) {
+    this->readyCond.wait(lock, [this] {
+      return !this->readyQueue.empty() || this->live == 0;
+    });
+    batch.swap(this->readyQueue);
+    lock.unlock();
+    for (std::coroutine_handle<> h : batch) h.resume();
+    batch.clear();
+    lock.lock();
+  }
+}
+
+
+void AsyncIo::submit(std::function<void()> job) {
+  {
+    std::lock_guard<std::mutex> lock(this->jobLock);
+    this->jobs.push_back(std::move(job));
+  }
+  this->jobCond.notify_one();
+}
+
+
+void AsyncIo::work() {
+  std::unique_lock<std::mutex> lock(this->jobLock);
+  for (;;) {
+    this->jobCond.wait(lock, [this] {
+      return this->stopping || !this->jobs.empty();
+    });
+    if (this->jobs.empty()) return;	// Stopping
+    std::function<void()> job = std::move(this->jobs.front());
+    this->jobs.pop_front();
+    lock.unlock();
+    job();
+    lock.lock();
+  }
+}
+
+
+FileOp<size_t> AsyncIo::async_read(File &file, void *ptr, size_t n) {
+  size_t have;
+  file.peek(&have);
+  return FileOp<size_t>(*this, have >= n,
+                        [&file, ptr, n] { return file.fread(ptr, 1, n); });
+}
+
+
+FileOp<size_t> AsyncIo::async_write(File &file, const void *ptr, size_t n) {
+  return FileOp<size_t>(*this, file.writable() >= n,
+                        [&file, ptr, n] { return file.fwrite(ptr, 1, n); });
+}
+
+
+FileOp<char *> AsyncIo::async_getline(File &file, char *s, int size) {
+  // Ready if a whole line (or as much as fits in s) is already buffered
+  size_t have;
+  const char *data = file.peek(&have);
+  bool ready = size > 0 && (have >= (size_t)size - 1 ||
+                            memchr(data, '\n', have) != NULL);
+  return FileOp<char *>(*this, ready,
+                        [&file, s, size] { return file.fgets(s, size); });
+}
+
+
+FileOp<int> AsyncIo::async_flush(File &file) {
+  return FileOp<int>(*this, false, [&file] { return file.fflush(); });
+}
@@ -0,0 +1,138 @@
+//
+// async_file.h
+//
+// C++20 coroutine interface to File: co_await reads, writes, line reads
+// and flushes without blocking the thread running the coroutines.
+//
+// Operations act on the File itself, so buffered data is shared with
+// the ordinary synchronous calls.  An operation the buffer can satisfy
+// on its own completes immediately, without suspending; anything that
+// needs a system call runs on a small thread pool and the coroutine is
+// resumed on the AsyncIo's own (single) thread when it finishes.
+//
+// Each File must have at most one operation in flight at a time.
+//
+// Requires C++20.
+//
+
+#if !defined(ASYNC_FILE_H)
+#define ASYNC_FILE_H
+
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class File;
+class AsyncIo;
+
+
+// A coroutine run by AsyncIo::spawn.  It can't be awaited; spawn it
+// and let AsyncIo::run drive it to completion.
+class Task {
+public:
+  struct promise_type {
+    AsyncIo *io = nullptr;
+
+    Task get_return_object() {
+      return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept;
+    void return_void() {}
+    void unhandled_exception();
+  };
+
+  Task(Task &&other) : handle(other.handle) { other.handle = nullptr; }
+  ~Task();
+
+private:
+  friend class AsyncIo;
+  std::coroutine_handle<promise_type> handle;
+
+  explicit Task(std::coroutine_handle<promise_type> h) : handle(h) {}
+  Task(Task const&) = delete;
+  Task& operator=(Task const&) = delete;
+};
+
+
+// Awaitable for one File operation; returned by the AsyncIo calls.
+template <typename Result>
+class FileOp {
+public:
+  FileOp(AsyncIo &io, bool ready, std::function<Result()> op)
+    : io(io), ready(ready), op(op) {}
+
+  bool await_ready() { return this->ready; }
+  void await_suspend(std::coroutine_handle<> h);
+  Result await_resume() { return this->ready ? this->op() : this->result; }
+
+private:
+  AsyncIo &io;
+  bool ready;
+  std::function<Result()> op;
+  Result result{};
+};
+
+
+class AsyncIo {
+public:
+  // threads is the number of pool threads doing blocking I/O.
+  explicit AsyncIo(int threads = 4);
+  ~AsyncIo();
+
+  // Queue a coroutine to start when run() is called (or, if run() is
+  // already going, soon).
+  void spawn(Task task);
+
+  // Run coroutines on this thread until all spawned tasks finish.
+  void run();
+
+  // Same results as File::fread, fwrite, fgets and fflush.
+  FileOp<size_t> async_read(File &file, void *ptr, size_t n);
+  FileOp<size_t> async_write(File &file, const void *ptr, size_t n);
+  FileOp<char *> async_getline(File &file, char *s, int size);
+  FileOp<int> async_flush(File &file);
+
+private:
+  template <typename Result> friend class FileOp;
+  friend struct Task::promise_type;
+
+  // Coroutines ready to resume on the run() thread
+  std::mutex readyLock;
+  std::condition_variable readyCond;
+  std::deque<std::coroutine_handle<>> readyQueue;
+  size_t live = 0;          // Spawned tasks not yet finished
+
+  // Blocking work for the pool
+  std::mutex jobLock;
+  std::condition_variable jobCond;
+  std::deque<std::function<void()>> jobs;
+  bool stopping = false;
+  std::vector<std::thread> pool;
+
+  void post(std::coroutine_handle<> h);
+  void submit(std::function<void()> job);
+  void finished();
+  void work();
+
+  // Disallow copy & assignment.
+  AsyncIo(AsyncIo const&) = delete;
+  AsyncIo& operator=(AsyncIo const&) = delete;
+};
+
+
+template <typename Result>
+void FileOp<Result>::await_suspend(std::coroutine_handle<> h) {
+  this->io.submit([this, h] {
+    this->result = this->op();
+    this->io.post(h);
+  });
+}
+
+
+#endif
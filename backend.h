@@ -0,0 +1,57 @@
+//
+// backend.h
+//
+// Interface for the storage underneath a File's buffer.  By default a
+// File reads and writes its file descriptor directly; a Backend lets a
+// layer such as encryption sit between the buffer and the descriptor.
+//
+
+#if !defined(BACKEND_H)
+#define BACKEND_H
+
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>	// fsync, fdatasync
+
+
+class Backend {
+public:
+  virtual ~Backend() {}
+
+  // Same contracts as read(2), write(2) and lseek(2): return -1 and set
+  // errno on failure.  Offsets are in the file's logical (plaintext)
+  // coordinates.
+  virtual ssize_t read(void *buf, size_t count) = 0;
+  virtual ssize_t write(const void *buf, size_t count) = 0;
+  virtual off_t seek(off_t offset, int whence) = 0;
+
+  // Gather write, as for writev(2).  By default only the first piece is
+  // written; the File sees a short write and comes back for the rest.
+  virtual ssize_t writev(const struct iovec *iov, int iovcnt) {
+    return iovcnt > 0 ? this->write(iov[0].iov_base, iov[0].iov_len) : 0;
+  }
+
+  // Push down anything the backend is holding.  Called by File::fflush.
+  virtual int flush() { return 0; }
+
+  // Force what has been written to stable storage, as fsync(2) does,
+  // or fdatasync(2) if dataOnly.  Called by File::sync, File::datasync
+  // and GroupCommit after flush.  The File doesn't sync its own
+  // descriptor when it has a backend, since the backend may be writing
+  // somewhere else: each backend syncs whatever it writes to.  By
+  // default this fails with EOPNOTSUPP, so that data is never reported
+  // durable when it isn't.
+  virtual int sync(bool) {
+    errno = EOPNOTSUPP;
+    return -1;
+  }
+
+protected:
+  static int syncFd(int fd, bool dataOnly) {
+    return dataOnly ? fdatasync(fd) : fsync(fd);
+  }
+};
+
+
+#endif
@@ -0,0 +1,313 @@
+//
+// basic_file.h
+//
+// BasicFile: a File whose access mode, buffering and storage are fixed
+// at compile time by policy classes, so that none of them is checked
+// on each call.  A read-only buffered file's fgetc is a bounds check
+// and a pointer bump; a write-only file's fputc the same.
+//
+//     ReadOnlyFile in("data.txt");
+//     for (int c; (c = in.fgetc()) != File::eof; ) ...
+//
+// Calling a function the access policy doesn't allow (fwrite on a
+// ReadOnlyFile, say) is a compile-time error.  File remains the
+// general-purpose class, with every option chosen at run time:
+// backends, checksums, line buffering, non-blocking mode and so on.
+//
+
+#if !defined(BASIC_FILE_H)
+#define BASIC_FILE_H
+
+#include "file.h"
+#include "memory_backend.h"
+#include "write_out.h"
+
+#include <fcntl.h>	// open
+#include <unistd.h>	// read, close, lseek
+#include <sys/uio.h>	// writev
+#include <stdlib.h>	// malloc, free
+#include <string.h>	// memcpy
+#include <string>
+#include <utility>
+
+
+// Access policies: what the file may be used for, and how it is opened.
+struct ReadAccess {
+  static const bool can_read = true;
+  static const bool can_write = false;
+  static const int open_flags = O_RDONLY;
+};
+
+struct WriteAccess {
+  static const bool can_read = false;
+  static const bool can_write = true;
+  static const int open_flags = O_WRONLY;
+};
+
+struct ReadWriteAccess {
+  static const bool can_read = true;
+  static const bool can_write = true;
+  static const int open_flags = O_RDWR;
+};
+
+
+// Buffering policies.  Unbuffered files pass each call to the storage.
+struct Buffered {
+  static const bool buffered = true;
+};
+
+struct Unbuffered {
+  static const bool buffered = false;
+};
+
+
+// Storage policies: the same contracts as read(2), writev(2) and
+// lseek(2).  The first constructor argument is the access policy's
+// open_flags; the rest come from BasicFile's constructor.
+
+// A named file.
+class FdStorage {
+public:
+  FdStorage(int flags, const char *name) : fd(open(name, flags)) {
+    if (this->fd < 0)
+      throw "Open failure";
+  }
+  ~FdStorage() {
+    close(this->fd);
+  }
+
+  int fileno() {
+    return this->fd;
+  }
+
+  ssize_t read(void *buf, size_t count) {
+    return ::read(this->fd, buf, count);
+  }
+  ssize_t writev(const struct iovec *iov, int iovcnt) {
+    return ::writev(this->fd, iov, iovcnt);
+  }
+  off_t seek(off_t offset, int whence) {
+    return lseek(this->fd, offset, whence);
+  }
+
+private:
+  int fd;
+
+  // Disallow copy & assignment.
+  FdStorage(FdStorage const&) = delete;
+  FdStorage& operator=(FdStorage const&) = delete;
+};
+
+
+// A file held in memory, optionally starting with some contents: a
+// MemoryBackend, called directly rather than through a File.
+class MemStorage: public MemoryBackend {
+public:
+  explicit MemStorage(int, const std::string &contents = std::string())
+    : MemoryBackend(contents) {
+  }
+};
+
+
+template <class Access, class Buffering = Buffered, class Storage = FdStorage>
+class BasicFile {
+public:
+  static const size_t bufsiz = File::bufsiz;
+
+  // Arguments after the open flags are passed on to the storage: the
+  // file name for FdStorage, the initial contents for MemStorage.
+  template <class... Args>
+  explicit BasicFile(Args&&... args)
+    : store(Access::open_flags, std::forward<Args>(args)...) {
+    if (Buffering::buffered)
+      this->buf = reinterpret_cast<char*>(malloc(bufsiz));
+  }
+
+  ~BasicFile() {
+    if (Access::can_write) this->fflush();
+    free(this->buf);
+  }
+
+  Storage &storage() {
+    return this->store;
+  }
+
+  // As for File.  In particular fread and fwrite return a count of
+  // bytes, not items, and File::eof if they fail before moving any.
+  int ferror() {
+    return this->err;
+  }
+
+  bool feof() {
+    return this->end;
+  }
+
+  int fflush() {
+    if (Access::can_read && this->bufEnd > 0) {
+      // Give back the read-ahead
+      if (this->bufAt < this->bufEnd &&
+          this->store.seek((off_t)this->bufAt - (off_t)this->bufEnd,
+                           SEEK_CUR) == (off_t)-1) {
+        this->err = -4;
+        return File::eof;
+      }
+    } else if (Access::can_write && this->bufAt > 0) {
+      // Whatever doesn't go out stays buffered for the next try
+      size_t written;
+      int rc = this->writeOut(this->buf, this->bufAt, NULL, 0, &written);
+      keepUnwritten(this->buf, &this->bufAt, written);
+      if (rc != 0) return File::eof;
+    }
+    this->bufAt = 0;
+    this->bufEnd = 0;
+    return 0;
+  }
+
+  size_t fread(void *ptr, size_t size, size_t nmemb) {
+    static_assert(Access::can_read, "file is not open for reading");
+    if (Access::can_write && this->bufEnd == 0 && this->bufAt > 0 &&
+        this->fflush() != 0)
+      return File::eof;
+    char *dst = (char *)ptr;
+    size_t len = size * nmemb;
+    size_t got = 0;
+    while (got < len) {
+      if (this->bufAt < this->bufEnd) {
+        size_t n = this->bufEnd - this->bufAt;
+        if (n > len - got) n = len - got;
+        memcpy(dst + got, this->buf + this->bufAt, n);
+        this->bufAt += n;
+        got += n;
+        continue;
+      }
+      ssize_t n;
+      if (!Buffering::buffered || len - got > bufsiz) {
+        n = this->store.read(dst + got, len - got);
+        if (n < 0) this->err = -3;
+        else got += n;
+      } else {
+        n = this->fill();
+      }
+      if (n == 0) this->end = true;
+      if (n < 0 && got == 0) return File::eof;
+      if (n <= 0) break;
+    }
+    return got;
+  }
+
+  size_t fwrite(const void *ptr, size_t size, size_t nmemb) {
+    static_assert(Access::can_write, "file is not open for writing");
+    if (Access::can_read && this->bufEnd > 0 && this->fflush() != 0)
+      return File::eof;
+    size_t len = size * nmemb;
+    if (Buffering::buffered && this->bufAt + len <= bufsiz) {
+      memcpy(this->buf + this->bufAt, ptr, len);
+      this->bufAt += len;
+      return len;
+    }
+    // Too big for the buffer: write both together
+    size_t written;
+    int rc = this->writeOut(this->buf, this->bufAt, (const char *)ptr, len,
+                            &written);
+    size_t taken = keepUnwritten(this->buf, &this->bufAt, written);
+    if (rc != 0) {
+      // Report any of ptr that did reach the file, so it isn't repeated
+      return (taken == 0) ? (size_t)File::eof : taken;
+    }
+    return len;
+  }
+
+  int fgetc() {
+    static_assert(Access::can_read, "file is not open for reading");
+    if (this->bufAt < this->bufEnd)
+      return (unsigned char)this->buf[this->bufAt++];
+    unsigned char c;
+    if (this->fread(&c, 1, 1) != 1) return File::eof;
+    return c;
+  }
+
+  int fputc(int c) {
+    static_assert(Access::can_write, "file is not open for writing");
+    if (Buffering::buffered) {
+      if (((Access::can_read && this->bufEnd > 0) || this->bufAt == bufsiz)
+          && this->fflush() != 0)
+        return File::eof;
+      this->buf[this->bufAt++] = (char)c;
+      return (unsigned char)c;
+    }
+    char ch = (char)c;
+    size_t written;
+    if (this->writeOut(NULL, 0, &ch, 1, &written) != 0) return File::eof;
+    return (unsigned char)c;
+  }
+
+  int fseek(long offset, File::Whence whence) {
+    int where;
+    if (whence == File::seek_set) where = SEEK_SET;
+    else if (whence == File::seek_cur) where = SEEK_CUR;
+    else if (whence == File::seek_end) where = SEEK_END;
+    else if (whence == File::seek_data) where = SEEK_DATA;
+    else if (whence == File::seek_hole) where = SEEK_HOLE;
+    else return -2;
+    if (this->fflush() != 0) return -1;
+    if (this->store.seek(offset, where) == (off_t)-1) return -1;
+    this->end = false;
+    return 0;
+  }
+
+  long ftell() {
+    off_t pos = this->store.seek(0, SEEK_CUR);
+    if (pos == (off_t)-1) return -1;
+    if (this->bufEnd > 0) pos -= this->bufEnd - this->bufAt;
+    else pos += this->bufAt;
+    return pos;
+  }
+
+private:
+  Storage store;
+  char *buf = NULL;
+  // Reading: unread data is [bufAt, bufEnd).  Writing: bufEnd is 0 and
+  // unwritten data is [0, bufAt).
+  size_t bufAt = 0;
+  size_t bufEnd = 0;
+  int err = 0;
+  bool end = false;
+
+  ssize_t fill() {
+    ssize_t n = this->store.read(this->buf, bufsiz);
+    if (n < 0) {
+      this->err = -2;
+      return -1;
+    }
+    this->bufAt = 0;
+    this->bufEnd = n;
+    return n;
+  }
+
+  // Write a, then b, as File::writeOut does.  *written is set to the
+  // number of bytes written, even on failure.
+  int writeOut(const char *a, size_t alen, const char *b, size_t blen,
+               size_t *written) {
+    Storage &store = this->store;
+    auto writev = [&store](const struct iovec *iov, int iovcnt) {
+      return store.writev(iov, iovcnt);
+    };
+    if (gatherWrite(writev, a, alen, b, blen, written) != 0) {
+      this->err = -1;
+      return File::eof;
+    }
+    return 0;
+  }
+
+  // Disallow copy & assignment.
+  BasicFile(BasicFile const&) = delete;
+  BasicFile& operator=(BasicFile const&) = delete;
+};
+
+
+typedef BasicFile<ReadAccess> ReadOnlyFile;
+typedef BasicFile<WriteAccess> WriteOnlyFile;
+typedef BasicFile<ReadWriteAccess> ReadWriteFile;
+
+
+#endif
@@ -0,0 +1,108 @@
+//
+// basic_file_bench.cc
+//
+// Compare File with BasicFile's compile-time policies on the small-call
+// paths where the run-time checks show: fputc, fgetc and 16-byte fread
+// and fwrite over a file of (by default) 64 MB.
+// Built by "make bench"; run from the top of the tree:
+//
+//     _build/bench/basic_file_bench [megabytes]
+//
+
+
+#include "basic_file.h"
+#include "file.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <chrono>
+
+
+static size_t total = (size_t)64 << 20;
+static char name[] = "/tmp/basic_file_benchXXXXXX";
+static volatile unsigned sink;
+
+
+static void truncate() {
+  if (::truncate(name, 0) != 0) perror("truncate");
+}
+
+
+template <class F>
+static void report(const char *what, F body) {
+  auto start = std::chrono::steady_clock::now();
+  body();
+  std::chrono::duration<double> secs =
+    std::chrono::steady_clock::now() - start;
+  printf("%-28s %7.3f s  %7.1f MB/s\n", what, secs.count(),
+         total / 1048576.0 / secs.count());
+}
+
+
+int main(int argc, char **argv) {
+  if (argc > 1) total = (size_t)atoi(argv[1]) << 20;
+  int fd = mkstemp(name);
+  if (fd < 0) {
+    perror("mkstemp");
+    return 1;
+  }
+  close(fd);
+
+  // fputc ("w" doesn't truncate, so start each run from empty)
+  report("File fputc", [] {
+    File f(name, "w");
+    for (size_t i = 0; i < total; i++) f.fputc('a' + i % 26);
+  });
+  truncate();
+  report("WriteOnlyFile fputc", [] {
+    WriteOnlyFile f(name);
+    for (size_t i = 0; i < total; i++) f.fputc('a' + i % 26);
+  });
+
+  // fgetc over what was just written
+  report("File fgetc", [] {
+    File f(name, "r");
+    unsigned sum = 0;
+    for (int c; (c = f.fgetc()) != File::eof; ) sum += c;
+    sink = sum;
+  });
+  report("ReadOnlyFile fgetc", [] {
+    ReadOnlyFile f(name);
+    unsigned sum = 0;
+    for (int c; (c = f.fgetc()) != File::eof; ) sum += c;
+    sink = sum;
+  });
+
+  // 16-byte records
+  char rec[16] = "0123456789abcde";
+  truncate();
+  report("File fwrite 16", [&rec] {
+    File f(name, "w");
+    for (size_t i = 0; i < total; i += sizeof(rec))
+      f.fwrite(rec, 1, sizeof(rec));
+  });
+  truncate();
+  report("WriteOnlyFile fwrite 16", [&rec] {
+    WriteOnlyFile f(name);
+    for (size_t i = 0; i < total; i += sizeof(rec))
+      f.fwrite(rec, 1, sizeof(rec));
+  });
+  report("File fread 16", [] {
+    File f(name, "r");
+    char r[16];
+    unsigned sum = 0;
+    while (f.fread(r, 1, sizeof(r)) == sizeof(r)) sum += r[0];
+    sink = sum;
+  });
+  report("ReadOnlyFile fread 16", [] {
+    ReadOnlyFile f(name);
+    char r[16];
+    unsigned sum = 0;
+    while (f.fread(r, 1, sizeof(r)) == sizeof(r)) sum += r[0];
+    sink = sum;
+  });
+
+  unlink(name);
+  return 0;
+}
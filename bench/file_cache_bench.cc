@@ -0,0 +1,141 @@
+//
+// file_cache_bench.cc
+//
+// Open/close churn over a set of (by default) 2000 small files: open
+// one at random, read its first line or append a line, close it.  Plain
+// File, which pays open(2), a buffer allocation and close(2) every
+// time, is compared with a FileCache large enough for every file and
+// with one holding only a quarter of them, which keeps evicting.  Each
+// is run on 1 and 4 threads; reports operations per second and the
+// 99th percentile time of an open-use-close.
+// Built by "make bench"; run from the top of the tree:
+//
+//     _build/bench/file_cache_bench [files [operations per thread]]
+//
+
+
+#include "file.h"
+#include "file_cache.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+static int files = 2000;
+static int ops = 100000;
+static char dir[] = "/tmp/file_cache_benchXXXXXX";
+static std::vector<std::string> names;
+
+
+// Run threads workers, each doing ops open-use-closes of random files
+// with use, and print throughput and the 99th percentile latency.  One
+// untimed pass over every file first fills the cache (and the kernel's
+// caches), so what is timed is the steady state.
+template <class Use>
+static void run(const char *what, int threads, Use use) {
+  for (const std::string &name : names) use(name.c_str());
+  std::vector<std::vector<double> > latency(threads);
+  std::vector<std::thread> workers;
+  auto start = std::chrono::steady_clock::now();
+  for (int t = 0; t < threads; t++) {
+    workers.emplace_back([&, t] {
+      std::minstd_rand pick(t + 1);
+      latency[t].reserve(ops);
+      for (int i = 0; i < ops; i++) {
+        const std::string &name = names[pick() % names.size()];
+        auto before = std::chrono::steady_clock::now();
+        use(name.c_str());
+        std::chrono::duration<double, std::micro> us =
+          std::chrono::steady_clock::now() - before;
+        latency[t].push_back(us.count());
+      }
+    });
+  }
+  for (std::thread &w : workers) w.join();
+  std::chrono::duration<double> secs =
+    std::chrono::steady_clock::now() - start;
+
+  std::vector<double> all;
+  for (std::vector<double> &l : latency) all.insert(all.end(), l.begin(),
+                                                    l.end());
+  std::sort(all.begin(), all.end());
+  printf("%-34s %d threads %9.0f ops/s  p99 %7.1f us\n", what, threads,
+         all.size() / secs.count(), all[all.size() * 99 / 100]);
+}
+
+
+static void readLine(File &f) {
+  char line[64];
+  if (f.fgets(line, sizeof(line)) == NULL) {
+    printf("read failed\n");
+    exit(1);
+  }
+}
+
+
+static void appendLine(File &f) {
+  f.fseek(0, File::seek_end);
+  f.fputs("another line\n");
+  f.fflush();
+}
+
+
+int main(int argc, char **argv) {
+  if (argc > 1) files = atoi(argv[1]);
+  if (argc > 2) ops = atoi(argv[2]);
+  if (mkdtemp(dir) == NULL) {
+    perror("mkdtemp");
+    return 1;
+  }
+  for (int i = 0; i < files; i++) {
+    std::string name = std::string(dir) + "/" + std::to_string(i);
+    int fd = open(name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0 || write(fd, "first line\n", 11) != 11) {
+      perror(name.c_str());
+      return 1;
+    }
+    close(fd);
+    names.push_back(name);
+  }
+
+  int counts[] = {1, 4};
+  for (int threads : counts) {
+    run("File, read a line", threads, [](const char *name) {
+      File f(name, "r");
+      readLine(f);
+    });
+    FileCache all(files);
+    run("FileCache (all), read a line", threads, [&all](const char *name) {
+      FileCache::Handle f = all.open(name, "r");
+      readLine(*f);
+    });
+    FileCache quarter(files / 4);
+    run("FileCache (1/4), read a line", threads,
+        [&quarter](const char *name) {
+      FileCache::Handle f = quarter.open(name, "r");
+      readLine(*f);
+    });
+    run("File, append a line", threads, [](const char *name) {
+      File f(name, "r+");
+      appendLine(f);
+    });
+    run("FileCache (all), append a line", threads,
+        [&all](const char *name) {
+      FileCache::Handle f = all.open(name, "r+");
+      appendLine(*f);
+    });
+  }
+
+  for (const std::string &name : names) unlink(name.c_str());
+  rmdir(dir);
+  return 0;
+}
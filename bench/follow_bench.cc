@@ -0,0 +1,111 @@
+//
+// follow_bench.cc
+//
+// Latency from append to delivery when following a growing file: a
+// writer thread appends timestamped lines at a steady rate, and the
+// reader reports how long each took to come out of fgets.  Follow mode
+// (FollowBackend, waiting on inotify) is compared with the usual loop
+// of reading to end-of-file and sleeping 1 ms or 10 ms before trying
+// again.  Also reports the CPU time the reader used: follow mode wakes
+// once per append, the polling loops once per sleep.
+// Built by "make bench"; run from the top of the tree:
+//
+//     _build/bench/follow_bench [lines [microseconds between lines]]
+//
+
+
+#include "file.h"
+#include "follow_backend.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+
+static int lines = 2000;
+static int gapUs = 500;
+static char name[] = "/tmp/follow_benchXXXXXX";
+
+
+static long long now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+// CPU time used by the calling thread, in milliseconds.
+static double threadCpuMs() {
+  struct rusage ru;
+  getrusage(RUSAGE_THREAD, &ru);
+  return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1e3 +
+         (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e3;
+}
+
+
+// Append lines, each holding the time it was written, one write each.
+static void writer() {
+  int fd = open(name, O_WRONLY | O_APPEND);
+  for (int i = 0; i < lines; i++) {
+    char line[32];
+    int n = snprintf(line, sizeof(line), "%lld\n", now());
+    if (write(fd, line, n) != n) {
+      perror("write");
+      exit(1);
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(gapUs));
+  }
+  close(fd);
+}
+
+
+// Read every line as the writer appends it, following the file if
+// sleepMs is 0 and otherwise sleeping that long at each end-of-file,
+// and print the delivery latencies.
+static void run(const char *what, int sleepMs) {
+  close(open(name, O_WRONLY | O_TRUNC));
+  File f(name, "r");
+  if (sleepMs == 0) f.setBackend(new FollowBackend(f.fileno(), name));
+  std::thread w(writer);
+  double cpuBefore = threadCpuMs();
+  std::vector<double> latency;
+  char line[32];
+  while ((int)latency.size() < lines) {
+    if (f.fgets(line, sizeof(line)) == NULL) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(sleepMs));
+      continue;
+    }
+    latency.push_back((now() - atoll(line)) / 1e3);
+  }
+  double cpu = threadCpuMs() - cpuBefore;
+  w.join();
+
+  std::sort(latency.begin(), latency.end());
+  printf("%-22s p50 %8.1f us  p99 %8.1f us  max %8.1f us  cpu %6.1f ms\n",
+         what, latency[latency.size() / 2],
+         latency[latency.size() * 99 / 100], latency.back(), cpu);
+}
+
+
+int main(int argc, char **argv) {
+  if (argc > 1) lines = atoi(argv[1]);
+  if (argc > 2) gapUs = atoi(argv[2]);
+  int fd = mkstemp(name);
+  if (fd < 0) {
+    perror("mkstemp");
+    return 1;
+  }
+  close(fd);
+
+  run("follow (inotify)", 0);
+  run("feof, sleep 1 ms", 1);
+  run("feof, sleep 10 ms", 10);
+
+  unlink(name);
+  return 0;
+}
@@ -0,0 +1,97 @@
+//
+// group_commit_bench.cc
+//
+// Durable appends from several threads, each to its own File: 100-byte
+// records made durable one at a time with File::datasync, and through
+// a GroupCommit at several commit intervals.  Reports records per
+// second and the latency of each commit (median and 99th percentile),
+// for 1, 4 and 16 threads.  Built by "make bench"; run from the top of
+// the tree:
+//
+//     _build/bench/group_commit_bench [directory [records per thread]]
+//
+// The files go in directory (default "."), which should be on the disk
+// being measured: on tmpfs, fdatasync costs nothing.
+//
+
+
+#include "file.h"
+#include "group_commit.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+static const char *dir = ".";
+static int records = 200;
+
+
+// Run threads writers, each committing every record with commit, and
+// print throughput and commit latency.
+template <class Commit>
+static void run(const char *what, int threads, Commit commit) {
+  std::vector<std::vector<double> > latency(threads);
+  std::vector<std::thread> workers;
+  auto start = std::chrono::steady_clock::now();
+  for (int t = 0; t < threads; t++) {
+    workers.emplace_back([&, t] {
+      std::string name = std::string(dir) + "/group_commit_bench." +
+                         std::to_string(t);
+      // File's "w" doesn't create or truncate the file
+      close(open(name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666));
+      File f(name.c_str(), "w");
+      char rec[100];
+      memset(rec, 'r', sizeof(rec));
+      rec[sizeof(rec) - 1] = '\n';
+      for (int i = 0; i < records; i++) {
+        f.fwrite(rec, 1, sizeof(rec));
+        auto before = std::chrono::steady_clock::now();
+        commit(f);
+        std::chrono::duration<double, std::micro> us =
+          std::chrono::steady_clock::now() - before;
+        latency[t].push_back(us.count());
+      }
+    });
+  }
+  for (std::thread &w : workers) w.join();
+  std::chrono::duration<double> secs =
+    std::chrono::steady_clock::now() - start;
+
+  std::vector<double> all;
+  for (std::vector<double> &l : latency) all.insert(all.end(), l.begin(),
+                                                    l.end());
+  std::sort(all.begin(), all.end());
+  printf("%-26s %3d threads %9.0f records/s  p50 %8.0f us  p99 %8.0f us\n",
+         what, threads, all.size() / secs.count(), all[all.size() / 2],
+         all[all.size() * 99 / 100]);
+  for (int t = 0; t < threads; t++)
+    unlink((std::string(dir) + "/group_commit_bench." +
+            std::to_string(t)).c_str());
+}
+
+
+int main(int argc, char **argv) {
+  if (argc > 1) dir = argv[1];
+  if (argc > 2) records = atoi(argv[2]);
+
+  int counts[] = {1, 4, 16};
+  for (int threads : counts) {
+    run("datasync per record", threads, [](File &f) { f.datasync(); });
+    int intervals[] = {0, 200, 1000};
+    for (int us : intervals) {
+      GroupCommit gc{std::chrono::microseconds(us)};
+      char what[32];
+      snprintf(what, sizeof(what), "GroupCommit %d us", us);
+      run(what, threads, [&gc](File &f) { gc.sync(f); });
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,96 @@
+//
+// inplace_update_bench.cc
+//
+// Time the record-at-a-time update loop that "r+" files are used for:
+// read a record, seek back over it, write it changed.  File keeps such
+// writes in its read buffer; the same loop with an fflush after each
+// write shows what a flush and refill per record costs, and stdio's
+// FILE is there for reference.  Every record, then every eighth, of a
+// file of (by default) 16 MB of 64-byte records.
+// Built by "make bench"; run from the top of the tree:
+//
+//     _build/bench/inplace_update_bench [megabytes]
+//
+
+
+#include "file.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+
+
+static const size_t recSize = 64;
+static size_t total = (size_t)16 << 20;
+static char name[] = "/tmp/inplace_update_benchXXXXXX";
+
+
+template <class F>
+static void report(const char *what, F body) {
+  auto start = std::chrono::steady_clock::now();
+  body();
+  std::chrono::duration<double> secs =
+    std::chrono::steady_clock::now() - start;
+  printf("%-32s %7.3f s  %7.1f MB/s\n", what, secs.count(),
+         total / 1048576.0 / secs.count());
+}
+
+
+// Update every stride'th record with File, flushing after each write if
+// asked to.
+static void updateFile(size_t stride, bool flushEach) {
+  File f(name, "r+");
+  char rec[recSize];
+  for (size_t i = 0; f.fread(rec, 1, recSize) == recSize; i++) {
+    if (i % stride != 0) continue;
+    rec[0]++;
+    f.fseek(-(long)recSize, File::seek_cur);
+    f.fwrite(rec, 1, recSize);
+    if (flushEach) f.fflush();
+  }
+}
+
+
+static void updateStdio(size_t stride) {
+  FILE *f = fopen(name, "r+");
+  char rec[recSize];
+  for (size_t i = 0; fread(rec, 1, recSize, f) == recSize; i++) {
+    if (i % stride != 0) continue;
+    rec[0]++;
+    fseek(f, -(long)recSize, SEEK_CUR);
+    fwrite(rec, 1, recSize, f);
+    // ISO C: a read can't follow a write without a positioning call
+    fseek(f, 0, SEEK_CUR);
+  }
+  fclose(f);
+}
+
+
+int main(int argc, char **argv) {
+  if (argc > 1) total = (size_t)atoi(argv[1]) << 20;
+  int fd = mkstemp(name);
+  if (fd < 0) {
+    perror("mkstemp");
+    return 1;
+  }
+  close(fd);
+  {
+    File f(name, "w");
+    char rec[recSize];
+    memset(rec, '.', recSize);
+    rec[recSize - 1] = '\n';
+    for (size_t i = 0; i < total; i += recSize) f.fwrite(rec, 1, recSize);
+  }
+
+  report("File every record", [] { updateFile(1, false); });
+  report("File every record, fflush", [] { updateFile(1, true); });
+  report("stdio every record", [] { updateStdio(1); });
+  report("File every 8th", [] { updateFile(8, false); });
+  report("File every 8th, fflush", [] { updateFile(8, true); });
+  report("stdio every 8th", [] { updateStdio(8); });
+
+  unlink(name);
+  return 0;
+}
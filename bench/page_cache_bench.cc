@@ -0,0 +1,91 @@
+//
+// page_cache_bench.cc
+//
+// Time a random mix of 64-byte record reads and updates (one in three
+// reads is followed by a rewrite) over a file of (by default) 16 MB,
+// on a plain File and on a File in page-cache mode with a 128-byte
+// buffer.  Three of four records come from the first megabyte, so
+// there is a working set for the cache to hold.
+// Built by "make bench"; run from the top of the tree:
+//
+//     _build/bench/page_cache_bench [megabytes]
+//
+
+
+#include "file.h"
+#include "page_cache_backend.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+
+
+static const size_t recSize = 64;
+static const int ops = 400000;
+static size_t total = (size_t)16 << 20;
+static char name[] = "/tmp/page_cache_benchXXXXXX";
+
+
+template <class F>
+static void report(const char *what, F body) {
+  auto start = std::chrono::steady_clock::now();
+  body();
+  std::chrono::duration<double> secs =
+    std::chrono::steady_clock::now() - start;
+  printf("%-32s %7.3f s  %7.0f ops/s\n", what, secs.count(),
+         ops / secs.count());
+}
+
+
+static void randomMix(size_t pageSize, size_t pages) {
+  File f(name, "r+");
+  if (pages > 0) {
+    setPageCache(f, pageSize, pages);
+    f.setvbuf(NULL, File::FULL_BUFFER, 2 * recSize);
+  }
+  size_t records = total / recSize;
+  size_t hot = (records < 16384) ? records : 16384;
+  srand(1);
+  char rec[recSize];
+  for (int i = 0; i < ops; i++) {
+    long at = (long)((i % 4 == 0) ? rand() % records : rand() % hot) *
+              recSize;
+    f.fseek(at, File::seek_set);
+    if (f.fread(rec, 1, recSize) != recSize) {
+      printf("short read at %ld\n", at);
+      exit(1);
+    }
+    if (rand() % 3 == 0) {
+      rec[i % recSize]++;
+      f.fseek(at, File::seek_set);
+      f.fwrite(rec, 1, recSize);
+    }
+  }
+}
+
+
+int main(int argc, char **argv) {
+  if (argc > 1) total = (size_t)atoi(argv[1]) << 20;
+  int fd = mkstemp(name);
+  if (fd < 0) {
+    perror("mkstemp");
+    return 1;
+  }
+  close(fd);
+  {
+    File f(name, "w");
+    char rec[recSize];
+    memset(rec, '.', recSize);
+    for (size_t i = 0; i < total; i += recSize) f.fwrite(rec, 1, recSize);
+  }
+
+  report("File", [] { randomMix(0, 0); });
+  report("File, 64 x 16K pages", [] { randomMix(16384, 64); });
+  report("File, 256 x 16K pages", [] { randomMix(16384, 256); });
+  report("File, 1024 x 4K pages", [] { randomMix(4096, 1024); });
+
+  unlink(name);
+  return 0;
+}
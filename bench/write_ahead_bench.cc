@@ -0,0 +1,120 @@
+//
+// write_ahead_bench.cc
+//
+// Large sequential writes with and without setWriteAhead: (by default)
+// 256 MB in 64 KB fwrites, to one file and round-robin to four files
+// at once, with no write-ahead and with steps of 1, 16 and 64 MB.
+// Reports throughput including a final fdatasync, the latency of each
+// fwrite (median, 99th and 99.9th percentile, and worst), and how many
+// extents the files ended up in.
+// Built by "make bench"; run from the top of the tree:
+//
+//     _build/bench/write_ahead_bench [directory [megabytes]]
+//
+// The files go in directory (default "."), which should be on the disk
+// being measured: tmpfs has no extents and no writeback to schedule.
+//
+
+
+#include "file.h"
+
+#include <fcntl.h>
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+
+static const char *dir = ".";
+static size_t total = (size_t)256 << 20;
+static const size_t chunk = 64 << 10;
+
+
+// Number of extents the file open on fd occupies, or -1 if the
+// filesystem can't say.
+static long extents(int fd) {
+  struct fiemap fm;
+  memset(&fm, 0, sizeof(fm));
+  fm.fm_length = FIEMAP_MAX_OFFSET;
+  fm.fm_flags = FIEMAP_FLAG_SYNC;
+  if (ioctl(fd, FS_IOC_FIEMAP, &fm) < 0) return -1;
+  return fm.fm_mapped_extents;
+}
+
+
+static std::string fileName(int i) {
+  return std::string(dir) + "/write_ahead_bench." + std::to_string(i);
+}
+
+
+// Write total bytes round-robin to writers files, each with write-ahead
+// step (0 for none), and print the results.
+static void run(int writers, off_t step) {
+  std::vector<File *> files;
+  for (int i = 0; i < writers; i++) {
+    std::string name = fileName(i);
+    // File's "w" doesn't create or truncate the file
+    close(open(name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666));
+    files.push_back(new File(name.c_str(), "w"));
+    if (step > 0 && files[i]->setWriteAhead(step) != 0) {
+      perror("setWriteAhead");
+      exit(1);
+    }
+  }
+  char *data = (char *)malloc(chunk);
+  memset(data, 'w', chunk);
+  std::vector<double> latency;
+  latency.reserve(total / chunk);
+
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < total / chunk; i++) {
+    auto before = std::chrono::steady_clock::now();
+    if (files[i % writers]->fwrite(data, 1, chunk) != chunk) {
+      printf("write failed\n");
+      exit(1);
+    }
+    std::chrono::duration<double, std::micro> us =
+      std::chrono::steady_clock::now() - before;
+    latency.push_back(us.count());
+  }
+  for (File *f : files) f->datasync();
+  std::chrono::duration<double> secs =
+    std::chrono::steady_clock::now() - start;
+
+  long count = 0;
+  for (File *f : files) {
+    long n = extents(f->fileno());
+    count = (n < 0 || count < 0) ? -1 : count + n;
+    delete f;
+  }
+  for (int i = 0; i < writers; i++) unlink(fileName(i).c_str());
+  free(data);
+
+  std::sort(latency.begin(), latency.end());
+  size_t n = latency.size();
+  printf("%d file%s, write-ahead %3ld MB %7.1f MB/s  p50 %6.0f us  "
+         "p99 %6.0f us  p99.9 %6.0f us  max %6.0f us  extents %ld\n",
+         writers, writers == 1 ? " " : "s", (long)(step >> 20),
+         total / 1048576.0 / secs.count(), latency[n / 2],
+         latency[n * 99 / 100], latency[n * 999 / 1000], latency[n - 1],
+         count);
+}
+
+
+int main(int argc, char **argv) {
+  if (argc > 1) dir = argv[1];
+  if (argc > 2) total = (size_t)atoi(argv[2]) << 20;
+
+  int writers[] = {1, 4};
+  off_t steps[] = {0, (off_t)1 << 20, (off_t)16 << 20, (off_t)64 << 20};
+  for (int w : writers)
+    for (off_t step : steps) run(w, step);
+  return 0;
+}
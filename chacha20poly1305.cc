@@ -0,0 +1,248 @@
+//
+// chacha20poly1305.cc
+//
+// Self-contained ChaCha20-Poly1305 authenticated encryption (RFC 8439),
+// so that encrypted Files build without an external crypto library.
+//
+// Poly1305 uses 26-bit limbs, after Andrew Moon's poly1305-donna.
+//
+
+
+#include "chacha20poly1305.h"
+
+#include <string.h>	// memcpy, memset
+
+
+namespace chacha20poly1305 {
+
+static inline uint32_t load32(const uint8_t *p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+         ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+
+static inline void store32(uint8_t *p, uint32_t v) {
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+
+static inline uint32_t rotl(uint32_t v, int n) {
+  return (v << n) | (v >> (32 - n));
+}
+
+
+#define QUARTER(a, b, c, d)                           \
+  a += b; d ^= a; d = rotl(d, 16);                    \
+  c += d; b ^= c; b = rotl(b, 12);                    \
+  a += b; d ^= a; d = rotl(d, 8);                     \
+  c += d; b ^= c; b = rotl(b, 7)
+
+
+// Produce one 64-byte block of keystream.
+static void block(const uint32_t in[16], uint8_t out[64]) {
+  uint32_t x[16];
+  memcpy(x, in, sizeof(x));
+  for (int i = 0; i < 10; i++) {
+    QUARTER(x[0], x[4], x[8], x[12]);
+    QUARTER(x[1], x[5], x[9], x[13]);
+    QUARTER(x[2], x[6], x[10], x[14]);
+    QUARTER(x[3], x[7], x[11], x[15]);
+    QUARTER(x[0], x[5], x[10], x[15]);
+    QUARTER(x[1], x[6], x[11], x[12]);
+    QUARTER(x[2], x[7], x[8], x[13]);
+    QUARTER(x[3], x[4], x[9], x[14]);
+  }
+  for (int i = 0; i < 16; i++) store32(out + 4 * i, x[i] + in[i]);
+}
+
+
+static void setup(uint32_t state[16], const uint8_t key[key_size],
+                  const uint8_t nonce[nonce_size], uint32_t counter) {
+  state[0] = 0x61707865;	// "expand 32-byte k"
+  state[1] = 0x3320646e;
+  state[2] = 0x79622d32;
+  state[3] = 0x6b206574;
+  for (int i = 0; i < 8; i++) state[4 + i] = load32(key + 4 * i);
+  state[12] = counter;
+  for (int i = 0; i < 3; i++) state[13 + i] = load32(nonce + 4 * i);
+}
+
+
+// XOR the keystream, starting at block 1, into in.
+static void crypt(uint32_t state[16], const uint8_t *in, size_t len,
+                  uint8_t *out) {
+  uint8_t ks[64];
+  state[12] = 1;
+  while (len > 0) {
+    block(state, ks);
+    state[12]++;
+    size_t n = len < 64 ? len : 64;
+    for (size_t i = 0; i < n; i++) out[i] = in[i] ^ ks[i];
+    in += n;
+    out += n;
+    len -= n;
+  }
+}
+
+
+class Poly1305 {
+public:
+  explicit Poly1305(const uint8_t key[32]) {
+    r[0] = (load32(key + 0)) & 0x3ffffff;
+    r[1] = (load32(key + 3) >> 2) & 0x3ffff03;
+    r[2] = (load32(key + 6) >> 4) & 0x3ffc0ff;
+    r[3] = (load32(key + 9) >> 6) & 0x3f03fff;
+    r[4] = (load32(key + 12) >> 8) & 0x00fffff;
+    for (int i = 0; i < 4; i++) pad[i] = load32(key + 16 + 4 * i);
+  }
+
+  // Absorb len bytes, zero-padded to a multiple of 16.
+  void update(const uint8_t *m, size_t len) {
+    while (len >= 16) {
+      blocks(m, 1 << 24);
+      m += 16;
+      len -= 16;
+    }
+    if (len > 0) {
+      uint8_t last[16] = {0};
+      memcpy(last, m, len);
+      blocks(last, 1 << 24);
+    }
+  }
+
+  void lengths(uint64_t aadLen, uint64_t len) {
+    uint8_t m[16];
+    store32(m, aadLen);
+    store32(m + 4, aadLen >> 32);
+    store32(m + 8, len);
+    store32(m + 12, len >> 32);
+    blocks(m, 1 << 24);
+  }
+
+  void finish(uint8_t tag[tag_size]);
+
+private:
+  uint32_t r[5];
+  uint32_t h[5] = {0, 0, 0, 0, 0};
+  uint32_t pad[4];
+
+  void blocks(const uint8_t m[16], uint32_t hibit);
+};
+
+
+void Poly1305::blocks(const uint8_t m[16], uint32_t hibit) {
+  uint32_t s1 = r[1] * 5, s2 = r[2] * 5, s3 = r[3] * 5, s4 = r[4] * 5;
+  h[0] += (load32(m + 0)) & 0x3ffffff;
+  h[1] += (load32(m + 3) >> 2) & 0x3ffffff;
+  h[2] += (load32(m + 6) >> 4) & 0x3ffffff;
+  h[3] += (load32(m + 9) >> 6) & 0x3ffffff;
+  h[4] += (load32(m + 12) >> 8) | hibit;
+
+  uint64_t d0 = (uint64_t)h[0] * r[0] + (uint64_t)h[1] * s4 +
+                (uint64_t)h[2] * s3 + (uint64_t)h[3] * s2 +
+                (uint64_t)h[4] * s1;
+  uint64_t d1 = (uint64_t)h[0] * r[1] + (uint64_t)h[1] * r[0] +
+                (uint64_t)h[2] * s4 + (uint64_t)h[3] * s3 +
+                (uint64_t)h[4] * s2;
+  uint64_t d2 = (uint64_t)h[0] * r[2] + (uint64_t)h[1] * r[1] +
+                (uint64_t)h[2] * r[0] + (uint64_t)h[3] * s4 +
+                (uint64_t)h[4] * s3;
+  uint64_t d3 = (uint64_t)h[0] * r[3] + (uint64_t)h[1] * r[2] +
+                (uint64_t)h[2] * r[1] + (uint64_t)h[3] * r[0] +
+                (uint64_t)h[4] * s4;
+  uint64_t d4 = (uint64_t)h[0] * r[4] + (uint64_t)h[1] * r[3] +
+                (uint64_t)h[2] * r[2] + (uint64_t)h[3] * r[1] +
+                (uint64_t)h[4] * r[0];
+
+  uint32_t c = (uint32_t)(d0 >> 26);
+  h[0] = (uint32_t)d0 & 0x3ffffff;
+  d1 += c; c = (uint32_t)(d1 >> 26); h[1] = (uint32_t)d1 & 0x3ffffff;
+  d2 += c; c = (uint32_t)(d2 >> 26); h[2] = (uint32_t)d2 & 0x3ffffff;
+  d3 += c; c = (uint32_t)(d3 >> 26); h[3] = (uint32_t)d3 & 0x3ffffff;
+  d4 += c; c = (uint32_t)(d4 >> 26); h[4] = (uint32_t)d4 & 0x3ffffff;
+  h[0] += c * 5;
+  c = h[0] >> 26;
+  h[0] &= 0x3ffffff;
+  h[1] += c;
+}
+
+
+void Poly1305::finish(uint8_t tag[tag_size]) {
+  uint32_t c = h[1] >> 26;
+  h[1] &= 0x3ffffff;
+  h[2] += c; c = h[2] >> 26; h[2] &= 0x3ffffff;
+  h[3] += c; c = h[3] >> 26; h[3] &= 0x3ffffff;
+  h[4] += c; c = h[4] >> 26; h[4] &= 0x3ffffff;
+  h[0] += c * 5; c = h[0] >> 26; h[0] &= 0x3ffffff;
+  h[1] += c;
+
+  // Compute h - p and keep it if it didn't go negative, in constant time.
+  uint32_t g[5];
+  g[0] = h[0] + 5; c = g[0] >> 26; g[0] &= 0x3ffffff;
+  g[1] = h[1] + c; c = g[1] >> 26; g[1] &= 0x3ffffff;
+  g[2] = h[2] + c; c = g[2] >> 26; g[2] &= 0x3ffffff;
+  g[3] = h[3] + c; c = g[3] >> 26; g[3] &= 0x3ffffff;
+  g[4] = h[4] + c - (1UL << 26);
+  uint32_t mask = (g[4] >> 31) - 1;
+  for (int i = 0; i < 5; i++) h[i] = (h[i] & ~mask) | (g[i] & mask);
+
+  uint32_t w0 = h[0] | (h[1] << 26);
+  uint32_t w1 = (h[1] >> 6) | (h[2] << 20);
+  uint32_t w2 = (h[2] >> 12) | (h[3] << 14);
+  uint32_t w3 = (h[3] >> 18) | (h[4] << 8);
+
+  uint64_t f = (uint64_t)w0 + pad[0];
+  store32(tag, (uint32_t)f);
+  f = (uint64_t)w1 + pad[1] + (f >> 32);
+  store32(tag + 4, (uint32_t)f);
+  f = (uint64_t)w2 + pad[2] + (f >> 32);
+  store32(tag + 8, (uint32_t)f);
+  f = (uint64_t)w3 + pad[3] + (f >> 32);
+  store32(tag + 12, (uint32_t)f);
+}
+
+
+static void mac(uint32_t state[16], const uint8_t *aad, size_t aadLen,
+                const uint8_t *ct, size_t len, uint8_t tag[tag_size]) {
+  uint8_t otk[64];
+  state[12] = 0;
+  block(state, otk);	// The one-time Poly1305 key is keystream block 0
+  Poly1305 poly(otk);
+  poly.update(aad, aadLen);
+  poly.update(ct, len);
+  poly.lengths(aadLen, len);
+  poly.finish(tag);
+  memset(otk, 0, sizeof(otk));
+}
+
+
+void seal(const uint8_t key[key_size], const uint8_t nonce[nonce_size],
+          const uint8_t *aad, size_t aadLen,
+          const uint8_t *in, size_t len, uint8_t *out,
+          uint8_t tag[tag_size]) {
+  uint32_t state[16];
+  setup(state, key, nonce, 0);
+  crypt(state, in, len, out);
+  mac(state, aad, aadLen, out, len, tag);
+}
+
+
+bool open(const uint8_t key[key_size], const uint8_t nonce[nonce_size],
+          const uint8_t *aad, size_t aadLen,
+          const uint8_t *in, size_t len, uint8_t *out,
+          const uint8_t tag[tag_size]) {
+  uint32_t state[16];
+  uint8_t expect[tag_size];
+  setup(state, key, nonce, 0);
+  mac(state, aad, aadLen, in, len, expect);
+  uint8_t diff = 0;
+  for (size_t i = 0; i < tag_size; i++) diff |= expect[i] ^ tag[i];
+  if (diff != 0) return false;
+  crypt(state, in, len, out);
+  return true;
+}
+
+}
@@ -0,0 +1,39 @@
+//
+// chacha20poly1305.h
+//
+// Self-contained ChaCha20-Poly1305 authenticated encryption (RFC 8439),
+// so that encrypted Files build without an external crypto library.
+//
+
+#if !defined(CHACHA20POLY1305_H)
+#define CHACHA20POLY1305_H
+
+#include <cstddef>
+#include <stdint.h>
+
+
+namespace chacha20poly1305 {
+
+const size_t key_size = 32;
+const size_t nonce_size = 12;
+const size_t tag_size = 16;
+
+// Encrypt len bytes of in into out (which may be the same buffer) and
+// write the authentication tag covering aad and the ciphertext.
+void seal(const uint8_t key[key_size], const uint8_t nonce[nonce_size],
+          const uint8_t *aad, size_t aadLen,
+          const uint8_t *in, size_t len, uint8_t *out,
+          uint8_t tag[tag_size]);
+
+// Check the tag, then decrypt len bytes of in into out (which may be the
+// same buffer).  Returns false, leaving out untouched, if the tag does
+// not match.
+bool open(const uint8_t key[key_size], const uint8_t nonce[nonce_size],
+          const uint8_t *aad, size_t aadLen,
+          const uint8_t *in, size_t len, uint8_t *out,
+          const uint8_t tag[tag_size]);
+
+}
+
+
+#endif
@@ -0,0 +1,192 @@
+//
+// checksum.cc
+//
+// Running checksums over a stream of bytes: CRC32C (using the SSE4.2
+// crc32 instruction when the CPU has it) and xxHash64.
+//
+
+
+#include "checksum.h"
+
+#include <string.h>	// memcpy
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+
+static const uint32_t CRC32C_POLY = 0x82f63b78;	// Castagnoli, reflected
+
+static uint32_t crcTable[256];
+
+static bool initTable() {
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t c = i;
+    for (int k = 0; k < 8; k++) c = (c >> 1) ^ (CRC32C_POLY & (0 - (c & 1)));
+    crcTable[i] = c;
+  }
+  return true;
+}
+
+static const bool tableReady = initTable();
+
+
+static uint32_t crc32cSoft(uint32_t crc, const uint8_t *p, size_t n) {
+  while (n-- > 0) crc = crcTable[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+  return crc;
+}
+
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32cHard(uint32_t crc, const uint8_t *p, size_t n) {
+  uint64_t c = crc;
+  for (; n > 0 && ((uintptr_t)p & 7) != 0; n--)
+    c = _mm_crc32_u8((uint32_t)c, *p++);
+  for (; n >= 8; n -= 8, p += 8) {
+    uint64_t word;
+    memcpy(&word, p, 8);
+    c = _mm_crc32_u64(c, word);
+  }
+  for (; n > 0; n--)
+    c = _mm_crc32_u8((uint32_t)c, *p++);
+  return (uint32_t)c;
+}
+
+static const bool haveSse42 = __builtin_cpu_supports("sse4.2");
+#endif
+
+
+uint32_t Checksum::crc32c(uint32_t crc, const void *p, size_t n) {
+  crc = ~crc;
+#if defined(__x86_64__)
+  if (haveSse42)
+    return ~crc32cHard(crc, (const uint8_t *)p, n);
+#endif
+  (void)tableReady;
+  return ~crc32cSoft(crc, (const uint8_t *)p, n);
+}
+
+
+static const uint64_t PRIME1 = 0x9e3779b185ebca87ULL;
+static const uint64_t PRIME2 = 0xc2b2ae3d27d4eb4fULL;
+static const uint64_t PRIME3 = 0x165667b19e3779f9ULL;
+static const uint64_t PRIME4 = 0x85ebca77c2b2ae63ULL;
+static const uint64_t PRIME5 = 0x27d4eb2f165667c5ULL;
+
+static inline uint64_t rotl64(uint64_t v, int n) {
+  return (v << n) | (v >> (64 - n));
+}
+
+static inline uint64_t read64(const uint8_t *p) {
+  uint64_t v;
+  memcpy(&v, p, 8);		// xxHash is defined little-endian
+  return v;
+}
+
+static inline uint32_t read32(const uint8_t *p) {
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return v;
+}
+
+static inline uint64_t xxRound(uint64_t acc, uint64_t input) {
+  acc += input * PRIME2;
+  return rotl64(acc, 31) * PRIME1;
+}
+
+static inline uint64_t xxMerge(uint64_t h, uint64_t acc) {
+  h ^= xxRound(0, acc);
+  return h * PRIME1 + PRIME4;
+}
+
+
+Checksum::Checksum(Kind kind, uint64_t seed) : kind(kind), seed(seed) {
+  this->reset();
+}
+
+
+void Checksum::reset() {
+  this->crc = 0;
+  this->acc[0] = this->seed + PRIME1 + PRIME2;
+  this->acc[1] = this->seed + PRIME2;
+  this->acc[2] = this->seed;
+  this->acc[3] = this->seed - PRIME1;
+  this->memSize = 0;
+  this->total = 0;
+}
+
+
+void Checksum::update(const void *ptr, size_t n) {
+  const uint8_t *p = (const uint8_t *)ptr;
+  if (n == 0) return;			// ptr may be NULL
+  if (this->kind == CRC32C) {
+    this->crc = crc32c(this->crc, p, n);
+    return;
+  }
+
+  this->total += n;
+  if (this->memSize + n < 32) {
+    memcpy(this->mem + this->memSize, p, n);
+    this->memSize += n;
+    return;
+  }
+  if (this->memSize > 0) {
+    // Complete the stripe left over from last time
+    size_t fill = 32 - this->memSize;
+    memcpy(this->mem + this->memSize, p, fill);
+    for (int i = 0; i < 4; i++)
+      this->acc[i] = xxRound(this->acc[i], read64(this->mem + 8 * i));
+    p += fill;
+    n -= fill;
+    this->memSize = 0;
+  }
+  uint64_t v0 = this->acc[0], v1 = this->acc[1];
+  uint64_t v2 = this->acc[2], v3 = this->acc[3];
+  for (; n >= 32; n -= 32, p += 32) {
+    v0 = xxRound(v0, read64(p));
+    v1 = xxRound(v1, read64(p + 8));
+    v2 = xxRound(v2, read64(p + 16));
+    v3 = xxRound(v3, read64(p + 24));
+  }
+  this->acc[0] = v0;
+  this->acc[1] = v1;
+  this->acc[2] = v2;
+  this->acc[3] = v3;
+  memcpy(this->mem, p, n);
+  this->memSize = n;
+}
+
+
+uint64_t Checksum::digest() const {
+  if (this->kind == CRC32C) return this->crc;
+
+  uint64_t h;
+  if (this->total >= 32) {
+    h = rotl64(this->acc[0], 1) + rotl64(this->acc[1], 7) +
+        rotl64(this->acc[2], 12) + rotl64(this->acc[3], 18);
+    for (int i = 0; i < 4; i++) h = xxMerge(h, this->acc[i]);
+  } else {
+    h = this->seed + PRIME5;
+  }
+  h += this->total;
+
+  const uint8_t *p = this->mem;
+  size_t n = this->memSize;
+  for (; n >= 8; n -= 8, p += 8)
+    h = rotl64(h ^ xxRound(0, read64(p)), 27) * PRIME1 + PRIME4;
+  if (n >= 4) {
+    h = rotl64(h ^ (read32(p) * PRIME1), 23) * PRIME2 + PRIME3;
+    n -= 4;
+    p += 4;
+  }
+  for (; n > 0; n--, p++)
+    h = rotl64(h ^ (*p * PRIME5), 11) * PRIME1;
+
+  h ^= h >> 33;
+  h *= PRIME2;
+  h ^= h >> 29;
+  h *= PRIME3;
+  h ^= h >> 32;
+  return h;
+}
@@ -0,0 +1,48 @@
+//
+// checksum.h
+//
+// Running checksums over a stream of bytes: CRC32C (using the SSE4.2
+// crc32 instruction when the CPU has it) and xxHash64.
+//
+
+#if !defined(CHECKSUM_H)
+#define CHECKSUM_H
+
+#include <cstddef>
+#include <stdint.h>
+
+
+class Checksum {
+public:
+  enum Kind {
+    CRC32C,
+    XXH64
+  };
+
+  explicit Checksum(Kind kind = CRC32C, uint64_t seed = 0);
+
+  // Add n bytes at p to the running checksum.
+  void update(const void *p, size_t n);
+
+  // Checksum of everything added so far.  For CRC32C only the low 32
+  // bits are used.
+  uint64_t digest() const;
+
+  // Start over.
+  void reset();
+
+  // One-shot CRC32C of n bytes at p, continuing from crc (0 to start).
+  static uint32_t crc32c(uint32_t crc, const void *p, size_t n);
+
+private:
+  Kind kind;
+  uint64_t seed;
+  uint32_t crc;
+  uint64_t acc[4];     // xxHash64 lane accumulators
+  uint8_t mem[32];     // xxHash64 partial stripe
+  size_t memSize;
+  uint64_t total;      // xxHash64 bytes consumed
+};
+
+
+#endif
@@ -0,0 +1,47 @@
+//
+// checksummed_backend.cc
+//
+// A Backend that stores a File's data in fixed-size blocks, each
+// followed by a CRC32C trailer.
+//
+
+
+#include "checksummed_backend.h"
+#include "checksum.h"
+
+#include <string.h>	// memcpy
+
+
+static uint32_t blockCrc(uint64_t index, const uint8_t *data, size_t n) {
+  uint8_t where[8];
+  for (int i = 0; i < 8; i++) where[i] = index >> (8 * i);
+  return Checksum::crc32c(Checksum::crc32c(0, data, n), where, sizeof(where));
+}
+
+
+ChecksummedBackend::ChecksummedBackend(int fd, size_t blockSize)
+  : ChunkedBackend(fd, blockSize, 4) {
+}
+
+
+ChecksummedBackend::~ChecksummedBackend() {
+  this->flush();
+}
+
+
+void ChecksummedBackend::encode(uint64_t index, const uint8_t *data,
+                                size_t n, bool, uint8_t *record) {
+  uint32_t crc = blockCrc(index, data, n);
+  if (record != data) memcpy(record, data, n);
+  for (int i = 0; i < 4; i++) record[n + i] = crc >> (8 * i);
+}
+
+
+bool ChecksummedBackend::decode(uint64_t index, const uint8_t *record,
+                                size_t n, bool, uint8_t *data) {
+  uint32_t stored = 0;
+  for (int i = 0; i < 4; i++) stored |= (uint32_t)record[n + i] << (8 * i);
+  if (blockCrc(index, record, n) != stored) return false;
+  memcpy(data, record, n);
+  return true;
+}
@@ -0,0 +1,38 @@
+//
+// checksummed_backend.h
+//
+// A Backend that stores a File's data in fixed-size blocks, each
+// followed by a 4-byte CRC32C trailer:
+//
+//     data (block_size bytes) | crc | data | crc | ... | data | crc
+//
+// Every block is verified when it is read, so a corrupted sector is
+// reported (read returns -1, errno EBADMSG) as soon as it is touched,
+// without scanning the whole file.  The CRC also covers the block's
+// index, so a block written in the wrong place is caught too.
+//
+
+#if !defined(CHECKSUMMED_BACKEND_H)
+#define CHECKSUMMED_BACKEND_H
+
+#include "chunked_backend.h"
+
+
+class ChecksummedBackend: public ChunkedBackend {
+public:
+  static const size_t default_block_size = 4096;
+
+  // Checksum the file open on fd, which stays owned by the caller.
+  explicit ChecksummedBackend(int fd,
+                              size_t blockSize = default_block_size);
+  ~ChecksummedBackend();
+
+protected:
+  void encode(uint64_t index, const uint8_t *data, size_t n, bool last,
+              uint8_t *record);
+  bool decode(uint64_t index, const uint8_t *record, size_t n, bool last,
+              uint8_t *data);
+};
+
+
+#endif
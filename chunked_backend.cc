@@ -0,0 +1,273 @@
+//
+// chunked_backend.cc
+//
+// Base for Backends that store a File's data as a sequence of
+// fixed-size chunks, each wrapped in a fixed-overhead record.
+//
+
+
+#include "chunked_backend.h"
+
+#include <sys/stat.h>	// fstat
+#include <unistd.h>	// pread, pwrite
+#include <stdlib.h>	// malloc, free
+#include <string.h>	// memcpy
+#include <errno.h>
+
+
+ChunkedBackend::ChunkedBackend(int fd, size_t chunkSize, size_t overhead,
+                               bool marksLast)
+  : chunkSize(chunkSize), overhead(overhead), marksLast(marksLast), fd(fd) {
+  this->plain = reinterpret_cast<uint8_t*>(malloc(chunkSize));
+  // One byte more than a record, so load can see whether another follows
+  this->record = reinterpret_cast<uint8_t*>(malloc(chunkSize + overhead + 1));
+  this->spare = marksLast ? reinterpret_cast<uint8_t*>(malloc(chunkSize))
+                          : NULL;
+}
+
+
+ChunkedBackend::~ChunkedBackend() {
+  free(this->plain);
+  free(this->record);
+  free(this->spare);
+}
+
+
+// Read and unwrap the current chunk into plain.
+int ChunkedBackend::load() {
+  size_t recordSize = this->chunkSize + this->overhead;
+  ssize_t n;
+  do {
+    n = pread(this->fd, this->record, recordSize + 1,
+              this->index * recordSize);
+  } while (n < 0 && errno == EINTR);
+  if (n < 0) return -1;
+  if (n == 0) {
+    this->len = 0;		// A new chunk at the end of the file
+  } else {
+    bool last = (size_t)n <= recordSize;
+    if (!last) n = recordSize;
+    if ((size_t)n <= this->overhead ||
+        !this->decode(this->index, this->record, n - this->overhead,
+                      last && this->marksLast && this->tailLast,
+                      this->plain)) {
+      errno = EBADMSG;
+      return -1;
+    }
+    this->len = n - this->overhead;
+  }
+  this->loaded = true;
+  return 0;
+}
+
+
+// Write the first total bytes of the staging area at where.
+int ChunkedBackend::writeRecord(off_t where, size_t total) {
+  size_t done = 0;
+  while (done < total) {
+    ssize_t w = pwrite(this->fd, this->record + done, total - done,
+                       where + done);
+    if (w < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    done += w;
+  }
+  return 0;
+}
+
+
+// Wrap n bytes of data and write them as the current chunk's record,
+// marked as the last record if it is one and canBeLast.
+int ChunkedBackend::store(const uint8_t *data, size_t n, bool canBeLast) {
+  bool tail = false;
+  if (this->marksLast) {
+    off_t count = this->records();
+    if (count < 0) return -1;
+    // Appending: the old last record is last no longer
+    if ((off_t)this->index == count && count > 0 && this->tailLast &&
+        this->reseal(count - 1, false) != 0)
+      return -1;
+    tail = (off_t)this->index + 1 >= count;
+  }
+  bool last = tail && canBeLast;
+  this->encode(this->index, data, n, last, this->record);
+  off_t where = this->index * (this->chunkSize + this->overhead);
+  if (this->writeRecord(where, n + this->overhead) != 0) return -1;
+  if (tail) {
+    // Keep the data for resealing, so that needn't read the file back
+    // (which it may not be open for)
+    memcpy(this->spare, data, n);
+    this->spareAt = this->index;
+    this->tailLast = last;
+  }
+  return 0;
+}
+
+
+// Seal record at, the file's last, again as last or not.
+int ChunkedBackend::reseal(uint64_t at, bool last) {
+  size_t recordSize = this->chunkSize + this->overhead;
+  off_t where = at * recordSize;
+  struct stat st;
+  if (fstat(this->fd, &st) < 0) return -1;
+  size_t n = st.st_size - where;
+  if (n > recordSize) n = recordSize;
+  if (n <= this->overhead) {
+    errno = EBADMSG;
+    return -1;
+  }
+  if (this->spareAt != (off_t)at) {
+    ssize_t got;
+    do {
+      got = pread(this->fd, this->record, n, where);
+    } while (got < 0 && errno == EINTR);
+    if (got < 0) return -1;
+    if ((size_t)got != n ||
+        !this->decode(at, this->record, n - this->overhead, !last,
+                      this->spare)) {
+      errno = EBADMSG;
+      return -1;
+    }
+    this->spareAt = at;
+  }
+  this->encode(at, this->spare, n - this->overhead, last, this->record);
+  if (this->writeRecord(where, n) != 0) return -1;
+  this->tailLast = last;
+  return 0;
+}
+
+
+// Store the current chunk if it has changed.
+int ChunkedBackend::writeBack(bool canBeLast) {
+  if (!this->dirty) return 0;
+  if (this->store(this->plain, this->len, canBeLast) != 0) return -1;
+  this->dirty = false;
+  return 0;
+}
+
+
+int ChunkedBackend::flush() {
+  if (this->writeBack(true) != 0) return -1;
+  if (this->marksLast && !this->tailLast) {
+    off_t count = this->records();
+    if (count < 0 || (count > 0 && this->reseal(count - 1, true) != 0))
+      return -1;
+  }
+  return 0;
+}
+
+
+// Number of records in the file, counting a partial one.
+off_t ChunkedBackend::records() {
+  struct stat st;
+  if (fstat(this->fd, &st) < 0) return -1;
+  off_t recordSize = this->chunkSize + this->overhead;
+  return (st.st_size + recordSize - 1) / recordSize;
+}
+
+
+// Logical (unwrapped) size of the file.
+off_t ChunkedBackend::size() {
+  struct stat st;
+  if (fstat(this->fd, &st) < 0) return -1;
+  off_t recordSize = this->chunkSize + this->overhead;
+  off_t rest = st.st_size % recordSize;
+  off_t bytes = (st.st_size / recordSize) * this->chunkSize;
+  if (rest > (off_t)this->overhead) bytes += rest - this->overhead;
+  if (this->loaded && this->dirty) {
+    off_t mine = this->index * this->chunkSize + this->len;
+    if (mine > bytes) bytes = mine;
+  }
+  return bytes;
+}
+
+
+ssize_t ChunkedBackend::read(void *buf, size_t count) {
+  uint8_t *dst = (uint8_t *)buf;
+  size_t done = 0;
+  while (done < count) {
+    if (!this->loaded && this->load() != 0)
+      return done > 0 ? (ssize_t)done : -1;
+    if (this->pos >= this->len) {
+      if (this->len < this->chunkSize) break; // End of file
+      if (this->writeBack(false) != 0) return done > 0 ? (ssize_t)done : -1;
+      this->index++;
+      this->pos = 0;
+      this->loaded = false;
+      continue;
+    }
+    size_t n = count - done;
+    if (n > this->len - this->pos) n = this->len - this->pos;
+    memcpy(dst + done, this->plain + this->pos, n);
+    this->pos += n;
+    done += n;
+  }
+  return done;
+}
+
+
+ssize_t ChunkedBackend::write(const void *buf, size_t count) {
+  const uint8_t *src = (const uint8_t *)buf;
+  size_t done = 0;
+  while (done < count) {
+    if (this->pos == this->chunkSize) {
+      if (this->writeBack(false) != 0) return done > 0 ? (ssize_t)done : -1;
+      this->index++;
+      this->pos = 0;
+      this->loaded = false;
+    }
+    size_t n = count - done;
+    if (n > this->chunkSize - this->pos) n = this->chunkSize - this->pos;
+    if (n == this->chunkSize) {
+      // A whole chunk: wrap it straight from the caller's buffer
+      if (this->store(src + done, n, false) != 0)
+        return done > 0 ? (ssize_t)done : -1;
+      this->loaded = false;
+      this->dirty = false;
+      this->pos = this->chunkSize;
+      done += n;
+      continue;
+    }
+    if (!this->loaded && this->load() != 0)
+      return done > 0 ? (ssize_t)done : -1;
+    memcpy(this->plain + this->pos, src + done, n);
+    this->pos += n;
+    if (this->pos > this->len) this->len = this->pos;
+    this->dirty = true;
+    done += n;
+  }
+  return done;
+}
+
+
+off_t ChunkedBackend::seek(off_t offset, int whence) {
+  off_t base;
+  if (whence == SEEK_SET) {
+    base = 0;
+  } else if (whence == SEEK_CUR) {
+    base = this->index * this->chunkSize + this->pos;
+  } else if (whence == SEEK_END) {
+    base = this->size();
+  } else {
+    errno = EINVAL;
+    return -1;
+  }
+  if (base < 0 || this->writeBack(false) != 0) return -1;
+  off_t target = base + offset;
+  off_t end = this->size();
+  if (end < 0) return -1;
+  if (target < 0 || target > end) {
+    errno = EINVAL;
+    return -1;
+  }
+  this->index = target / this->chunkSize;
+  this->pos = target % this->chunkSize;
+  this->loaded = false;
+  return target;
+}
+
+
+int ChunkedBackend::sync(bool dataOnly) {
+  return syncFd(this->fd, dataOnly);
+}
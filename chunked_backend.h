@@ -0,0 +1,87 @@
+//
+// chunked_backend.h
+//
+// Base for Backends that store a File's data as a sequence of
+// fixed-size chunks, each wrapped in a record with a fixed amount of
+// extra data (a checksum, a nonce and tag, ...).  Records are all the
+// same size except possibly the last, so a logical offset maps directly
+// to a chunk index and a physical offset, and seeking costs no scanning.
+//
+// Subclasses supply encode and decode, and must call flush() in their
+// destructors (the base class can't, since encode is virtual).
+//
+// A subclass may ask for the file's last record to be marked, so that
+// cutting records off the end can be detected: encode and decode are
+// told whether the record is the last one.  Records are written as not
+// last, and flush seals the file's last record as last; appending after
+// that seals it again as not last before writing the new record.
+//
+
+#if !defined(CHUNKED_BACKEND_H)
+#define CHUNKED_BACKEND_H
+
+#include "backend.h"
+
+#include <stdint.h>
+
+
+class ChunkedBackend: public Backend {
+public:
+  ~ChunkedBackend();
+
+  ssize_t read(void *buf, size_t count);
+  ssize_t write(const void *buf, size_t count);
+  // Seeking past the end of the data is not supported (EINVAL).
+  off_t seek(off_t offset, int whence);
+  int flush();
+  int sync(bool dataOnly);
+
+protected:
+  // fd stays owned by the caller.  If marksLast, the last record is
+  // marked as described above; otherwise last is always false.
+  ChunkedBackend(int fd, size_t chunkSize, size_t overhead,
+                 bool marksLast = false);
+
+  // Wrap n bytes of data from chunk index into a record of n + overhead
+  // bytes.  last says whether it is the file's last record.
+  virtual void encode(uint64_t index, const uint8_t *data, size_t n,
+                      bool last, uint8_t *record) = 0;
+
+  // Check a record holding n bytes of data, expected to be the file's
+  // last record if last, and unwrap it into data.  Return false if the
+  // record is corrupt.
+  virtual bool decode(uint64_t index, const uint8_t *record, size_t n,
+                      bool last, uint8_t *data) = 0;
+
+  const size_t chunkSize;
+  const size_t overhead;
+  const bool marksLast;
+
+private:
+  int fd;
+  uint8_t *plain;       // Current chunk, unwrapped
+  uint8_t *record;      // Staging area for records
+  uint8_t *spare;       // Last record's data, if marksLast
+  off_t spareAt = -1;   // Which record spare holds, or -1
+  uint64_t index = 0;   // Current chunk number
+  size_t len = 0;       // Bytes of data in the current chunk
+  size_t pos = 0;       // Position within the current chunk
+  bool loaded = false;  // Has plain been read from disk?
+  bool dirty = false;   // Does plain need to be written back?
+  bool tailLast = true; // Is the file's last record marked as last?
+
+  int load();
+  int store(const uint8_t *data, size_t n, bool canBeLast);
+  int writeBack(bool canBeLast);
+  int reseal(uint64_t at, bool last);
+  int writeRecord(off_t where, size_t total);
+  off_t records();
+  off_t size();
+
+  // Disallow copy & assignment.
+  ChunkedBackend(ChunkedBackend const&) = delete;
+  ChunkedBackend& operator=(ChunkedBackend const&) = delete;
+};
+
+
+#endif
@@ -0,0 +1,111 @@
+//
+// concat_backend.cc
+//
+// A read-only Backend that presents a list of files as one stream,
+// opening upcoming files on background threads.
+//
+
+
+#include "concat_backend.h"
+
+#include <fcntl.h>	// open, posix_fadvise
+#include <unistd.h>	// read, close
+#include <errno.h>
+
+
+ConcatBackend::ConcatBackend(const std::vector<std::string> &paths,
+                             size_t ahead, int threads)
+  : paths(paths), ahead(ahead > 0 ? ahead : 1),
+    fds(paths.size(), NOT_OPEN), errs(paths.size(), 0) {
+  for (int i = 0; i < threads; i++)
+    this->openers.emplace_back(&ConcatBackend::openAhead, this);
+}
+
+
+ConcatBackend::~ConcatBackend() {
+  {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    this->stopping = true;
+  }
+  this->wanted.notify_all();
+  for (std::thread &t : this->openers) t.join();
+  for (int fd : this->fds) {
+    if (fd >= 0) close(fd);
+  }
+}
+
+
+size_t ConcatBackend::current() {
+  std::lock_guard<std::mutex> lock(this->mtx);
+  return this->at;
+}
+
+
+// Thread body: keep the files just after the one being read open.
+void ConcatBackend::openAhead() {
+  std::unique_lock<std::mutex> lock(this->mtx);
+  for (;;) {
+    this->wanted.wait(lock, [this] {
+      return this->stopping || (this->nextOpen < this->paths.size() &&
+                                this->nextOpen < this->at + this->ahead);
+    });
+    if (this->stopping) return;
+    size_t i = this->nextOpen++;
+    lock.unlock();
+    int fd = open(this->paths[i].c_str(), O_RDONLY | O_CLOEXEC);
+    int e = errno;
+    if (fd >= 0) posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    lock.lock();
+    this->fds[i] = fd;
+    this->errs[i] = (fd < 0) ? e : 0;
+    this->opened.notify_all();
+  }
+}
+
+
+ssize_t ConcatBackend::read(void *buf, size_t count) {
+  std::unique_lock<std::mutex> lock(this->mtx);
+  while (this->at < this->paths.size()) {
+    size_t i = this->at;
+    this->opened.wait(lock, [this, i] { return this->fds[i] != NOT_OPEN; });
+    int fd = this->fds[i];
+    if (fd < 0) {
+      // Report the failure once, then move on
+      errno = this->errs[i];
+      this->at++;
+      this->wanted.notify_one();
+      return -1;
+    }
+    lock.unlock();
+    ssize_t n = ::read(fd, buf, count);
+    if (n != 0 || count == 0) {
+      if (n > 0) this->pos += n;
+      return n;
+    }
+    close(fd);			// This file is done
+    lock.lock();
+    this->fds[i] = -1;
+    this->at++;
+    this->wanted.notify_one();
+  }
+  return 0;
+}
+
+
+ssize_t ConcatBackend::write(const void *, size_t) {
+  errno = EBADF;
+  return -1;
+}
+
+
+off_t ConcatBackend::seek(off_t offset, int whence) {
+  if (offset == 0 && whence == SEEK_CUR) return this->pos;
+  errno = ESPIPE;
+  return -1;
+}
+
+
+// Read-only: nothing written to sync.
+int ConcatBackend::sync(bool) {
+  return 0;
+}
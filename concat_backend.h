@@ -0,0 +1,69 @@
+//
+// concat_backend.h
+//
+// A read-only Backend that presents a list of files as one stream, for
+// working through directories of many small files.  Use it with
+// File(Backend *, "r") and read with fread/fgets as usual.
+//
+// Background threads open the next few files ahead of the reader and
+// ask the kernel to start reading them in (POSIX_FADV_WILLNEED), so the
+// reader rarely waits on open(2) or on the disk at a file boundary.
+//
+// A file that can't be opened makes one read fail with its errno;
+// reading then continues with the next file.
+//
+
+#if !defined(CONCAT_BACKEND_H)
+#define CONCAT_BACKEND_H
+
+#include "backend.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+class ConcatBackend: public Backend {
+public:
+  // Open up to ahead files in advance, using threads threads.
+  explicit ConcatBackend(const std::vector<std::string> &paths,
+                         size_t ahead = 8, int threads = 2);
+  ~ConcatBackend();
+
+  // Index in paths of the file now being read.
+  size_t current();
+
+  ssize_t read(void *buf, size_t count);
+  // Writing fails with EBADF.
+  ssize_t write(const void *buf, size_t count);
+  // Only reports the position (seek(0, SEEK_CUR)); otherwise ESPIPE.
+  off_t seek(off_t offset, int whence);
+  int sync(bool dataOnly);
+
+private:
+  enum { NOT_OPEN = -2 };
+
+  std::vector<std::string> paths;
+  size_t ahead;
+  std::vector<int> fds;      // NOT_OPEN, -1 (failed) or a descriptor
+  std::vector<int> errs;     // errno for files that failed to open
+  size_t at = 0;             // File being read
+  size_t nextOpen = 0;       // Next file for a thread to open
+  off_t pos = 0;             // Bytes delivered so far
+  bool stopping = false;
+  std::mutex mtx;
+  std::condition_variable opened;
+  std::condition_variable wanted;
+  std::vector<std::thread> openers;
+
+  void openAhead();
+
+  // Disallow copy & assignment.
+  ConcatBackend(ConcatBackend const&) = delete;
+  ConcatBackend& operator=(ConcatBackend const&) = delete;
+};
+
+
+#endif
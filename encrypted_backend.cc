@@ -0,0 +1,74 @@
+//
+// encrypted_backend.cc
+//
+// A Backend that keeps a File's data encrypted at rest, one
+// authenticated ChaCha20-Poly1305 record per chunk.
+//
+
+
+#include "encrypted_backend.h"
+
+#include <sys/random.h>	// getrandom
+#include <string.h>	// memcpy
+
+using namespace chacha20poly1305;
+
+
+// Fill p with n random bytes.
+static void randomBytes(uint8_t *p, size_t n) {
+  while (n > 0) {
+    ssize_t got = getrandom(p, n, 0);
+    if (got < 0) continue;	// EINTR
+    p += got;
+    n -= got;
+  }
+}
+
+
+// The chunk index is authenticated with each record, so records can't
+// be swapped around within the file undetected, and so is a flag on
+// the last record, so records can't be cut off the end undetected.
+static void recordAad(uint64_t index, bool last, uint8_t aad[9]) {
+  for (int i = 0; i < 8; i++) aad[i] = index >> (8 * i);
+  aad[8] = last ? 1 : 0;
+}
+
+
+EncryptedBackend::EncryptedBackend(int fd, const uint8_t key[key_size])
+  : ChunkedBackend(fd, chunk_size, nonce_size + tag_size, true) {
+  memcpy(this->key, key, key_size);
+  randomBytes(this->noncePrefix, sizeof(this->noncePrefix));
+}
+
+
+EncryptedBackend::~EncryptedBackend() {
+  this->flush();
+  volatile uint8_t *k = this->key;
+  for (size_t i = 0; i < key_size; i++) k[i] = 0;
+}
+
+
+void EncryptedBackend::encode(uint64_t index, const uint8_t *data, size_t n,
+                              bool last, uint8_t *record) {
+  // Nonces are a random per-backend prefix plus a counter, so no two
+  // records sealed with the same key share one.
+  if (++this->nonceCount == 0)
+    randomBytes(this->noncePrefix, sizeof(this->noncePrefix));
+  memcpy(record, this->noncePrefix, sizeof(this->noncePrefix));
+  for (int i = 0; i < 4; i++)
+    record[sizeof(this->noncePrefix) + i] = this->nonceCount >> (8 * i);
+
+  uint8_t aad[9];
+  recordAad(index, last, aad);
+  seal(this->key, record, aad, sizeof(aad), data, n, record + nonce_size,
+       record + nonce_size + n);
+}
+
+
+bool EncryptedBackend::decode(uint64_t index, const uint8_t *record,
+                              size_t n, bool last, uint8_t *data) {
+  uint8_t aad[9];
+  recordAad(index, last, aad);
+  return open(this->key, record, aad, sizeof(aad), record + nonce_size, n,
+              data, record + nonce_size + n);
+}
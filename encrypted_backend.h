@@ -0,0 +1,57 @@
+//
+// encrypted_backend.h
+//
+// A Backend that keeps a File's data encrypted at rest.  The plaintext
+// is cut into fixed-size chunks and each chunk is stored as one
+// authenticated ChaCha20-Poly1305 record:
+//
+//     nonce (12 bytes) | ciphertext (up to chunk_size bytes) | tag (16)
+//
+// The chunk index is authenticated along with each record, and so is
+// whether it is the file's last record (as in the STREAM construction).
+// A tampered or misplaced record fails to authenticate, as does the
+// new last record of a file cut short at a record boundary, and the
+// read returns -1 with errno set to EBADMSG.
+//
+// Limitations:
+//  - A file cut to nothing at all can't be told from an empty one.
+//  - The last record is marked when the backend is flushed (File's
+//    fflush, sync and close all do this).  A file whose writer died
+//    before flushing reads as cut short, even if no data was lost.
+//  - Appending costs up to two extra record reads and writes per flush:
+//    re-sealing the old last record, and sealing the new one.
+//
+
+#if !defined(ENCRYPTED_BACKEND_H)
+#define ENCRYPTED_BACKEND_H
+
+#include "chunked_backend.h"
+#include "chacha20poly1305.h"
+#include "file.h"
+
+
+class EncryptedBackend: public ChunkedBackend {
+public:
+  // Plaintext bytes per record.  Matches File's default buffer so that
+  // each full-buffer flush seals exactly one record.
+  static const size_t chunk_size = File::bufsiz;
+
+  // Encrypt the file open on fd (which stays owned by the caller) with
+  // a 32-byte key.  The file must be empty or written with the same key.
+  EncryptedBackend(int fd, const uint8_t key[chacha20poly1305::key_size]);
+  ~EncryptedBackend();
+
+protected:
+  void encode(uint64_t index, const uint8_t *data, size_t n, bool last,
+              uint8_t *record);
+  bool decode(uint64_t index, const uint8_t *record, size_t n, bool last,
+              uint8_t *data);
+
+private:
+  uint8_t key[chacha20poly1305::key_size];
+  uint8_t noncePrefix[8];
+  uint32_t nonceCount = 0;
+};
+
+
+#endif
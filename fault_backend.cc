@@ -0,0 +1,129 @@
+//
+// fault_backend.cc
+//
+// A Backend that injects I/O failures at scripted or random points.
+//
+
+
+#include "fault_backend.h"
+
+#include <unistd.h>	// read, write, lseek
+#include <sys/uio.h>	// writev
+#include <errno.h>
+
+
+FaultBackend::FaultBackend(int fd) : fd(fd) {
+}
+
+
+void FaultBackend::inject(Op op, unsigned long n, Fault fault) {
+  this->script[std::make_pair((int)op, n)] = fault;
+}
+
+
+void FaultBackend::randomize(uint64_t seed, unsigned every, unsigned faults) {
+  this->state = seed;
+  this->every = every;
+  this->faults = faults;
+}
+
+
+unsigned long FaultBackend::calls(Op op) {
+  return this->count[op];
+}
+
+
+unsigned long FaultBackend::failures(Op op) {
+  return this->failed[op];
+}
+
+
+int FaultBackend::next(Op op) {
+  unsigned long n = this->count[op]++;
+  int fault = 0;
+  std::map<std::pair<int, unsigned long>, Fault>::iterator it =
+    this->script.find(std::make_pair((int)op, n));
+  if (it != this->script.end()) {
+    fault = it->second;
+  } else if (this->every > 0 && this->faults != 0) {
+    // splitmix64: cheap, and the same sequence for the same seed
+    uint64_t z = (this->state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    z ^= z >> 31;
+    if (z % this->every == 0) {
+      // Pick one of the allowed faults
+      int choices[5];
+      int k = 0;
+      for (int bit = 0; bit < 5; bit++) {
+        if (this->faults & (1 << bit)) choices[k++] = 1 << bit;
+      }
+      fault = choices[(z >> 32) % k];
+    }
+  }
+  if (op == SEEK && fault == short_io) fault = 0;
+  if (fault != 0) this->failed[op]++;
+  return fault;
+}
+
+
+int FaultBackend::errnoFor(int fault) {
+  switch (fault) {
+  case interrupted: return EINTR;
+  case would_block: return EAGAIN;
+  case no_space: return ENOSPC;
+  default: return EIO;
+  }
+}
+
+
+ssize_t FaultBackend::read(void *buf, size_t count) {
+  int fault = this->next(READ);
+  if (fault == short_io && count > 1) {
+    count /= 2;
+  } else if (fault != 0 && fault != short_io) {
+    errno = errnoFor(fault);
+    return -1;
+  }
+  return ::read(this->fd, buf, count);
+}
+
+
+ssize_t FaultBackend::write(const void *buf, size_t count) {
+  struct iovec iov;
+  iov.iov_base = (void *)buf;
+  iov.iov_len = count;
+  return this->writev(&iov, 1);
+}
+
+
+ssize_t FaultBackend::writev(const struct iovec *iov, int iovcnt) {
+  int fault = this->next(WRITE);
+  if (fault == 0) return ::writev(this->fd, iov, iovcnt);
+  if (fault != short_io) {
+    errno = errnoFor(fault);
+    return -1;
+  }
+  // Write half of the first non-empty piece
+  for (int i = 0; i < iovcnt; i++) {
+    size_t len = iov[i].iov_len;
+    if (len == 0) continue;
+    return ::write(this->fd, iov[i].iov_base, len > 1 ? len / 2 : 1);
+  }
+  return 0;
+}
+
+
+off_t FaultBackend::seek(off_t offset, int whence) {
+  int fault = this->next(SEEK);
+  if (fault != 0) {
+    errno = errnoFor(fault);
+    return -1;
+  }
+  return lseek(this->fd, offset, whence);
+}
+
+
+int FaultBackend::sync(bool dataOnly) {
+  return syncFd(this->fd, dataOnly);
+}
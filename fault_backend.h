@@ -0,0 +1,77 @@
+//
+// fault_backend.h
+//
+// A Backend for testing error handling: it passes reads, writes and
+// seeks through to a file descriptor, except for the calls chosen to
+// fail.  Failures are scripted (the nth write returns ENOSPC) or drawn
+// from a seeded generator, so any failing run can be replayed exactly.
+//
+// A short read or write transfers half of what was asked for (at least
+// one byte).  The other faults transfer nothing and return -1 with
+// errno set: EINTR, EAGAIN, ENOSPC or EIO.  Seeks can fail but can't be
+// short.
+//
+
+#if !defined(FAULT_BACKEND_H)
+#define FAULT_BACKEND_H
+
+#include "backend.h"
+
+#include <map>
+#include <stdint.h>
+#include <utility>
+
+
+class FaultBackend: public Backend {
+public:
+  enum Op {
+    READ,
+    WRITE,
+    SEEK
+  };
+
+  // Use lowercase because errno.h #defines the uppercase names.
+  enum Fault {
+    short_io = 1 << 0,
+    interrupted = 1 << 1,	// EINTR
+    would_block = 1 << 2,	// EAGAIN
+    no_space = 1 << 3,		// ENOSPC
+    io_error = 1 << 4		// EIO
+  };
+
+  // Work on fd, which stays owned by the caller.
+  explicit FaultBackend(int fd);
+
+  // Make call number n (counting from 0) of op fail with fault.
+  void inject(Op op, unsigned long n, Fault fault);
+
+  // Also fail one call in every (on average), with a fault picked from
+  // faults (a mask of Fault values).  0 turns random faults off.
+  void randomize(uint64_t seed, unsigned every, unsigned faults);
+
+  // Calls of op so far, and how many of them failed.
+  unsigned long calls(Op op);
+  unsigned long failures(Op op);
+
+  ssize_t read(void *buf, size_t count);
+  ssize_t write(const void *buf, size_t count);
+  ssize_t writev(const struct iovec *iov, int iovcnt);
+  off_t seek(off_t offset, int whence);
+  int sync(bool dataOnly);
+
+private:
+  int fd;
+  std::map<std::pair<int, unsigned long>, Fault> script;
+  uint64_t state = 0;
+  unsigned every = 0;
+  unsigned faults = 0;
+  unsigned long count[3] = {0, 0, 0};
+  unsigned long failed[3] = {0, 0, 0};
+
+  // The fault for the next call of op, or 0 to let it through.
+  int next(Op op);
+  static int errnoFor(int fault);
+};
+
+
+#endif
@@ -10,41 +10,74 @@
 
 
 #include "file.h"
+#include "backend.h"
+#include "checksum.h"
+#include "scan.h"
+#include "utf8.h"
+#include "write_out.h"
 
-#include <fcntl.h>	// open
+#include <fcntl.h>	// open, fallocate, sync_file_range
 #include <unistd.h>	// read
 #include <sys/types.h>		// read
+#include <sys/stat.h>	// fchmod
+#include <sys/uio.h>	// writev
 #include <stdlib.h>     // malloc, free
+#include <string.h>     // memcpy
+#include <stdio.h>      // snprintf, rename
+#include <errno.h>
+#include <poll.h>	// POLLIN, POLLOUT
 #include <cassert>
 #include <cstdarg>
 
 static char *itoa(int, char*);
+static char *dirOf(const char *);
+static int openTemp(const char *, int, char **);
+static int modeFlags(const char *, char *);
 
 // Opens the file in the correct mode and allocates the buffer
 File::File(const char *name, const char *mode) {
-  if (mode[0] == 'r' && mode[1] == '\0') {
-    this->fd = open(name, O_RDONLY);
-    this->fmode = 'r';
-  } else if (mode[0] == 'w' && mode[1] == '\0') {
-    this->fd = open(name, O_WRONLY);
-    this->fmode = 'w';
-  } else if ((mode[0] == 'r' || mode[0] == 'w') && mode[1] == '+') {
-    this->fd = open(name, O_RDWR);
-    this->fmode = '+';
+  int flags = modeFlags(mode, &this->fmode);
+  if (flags == -1)
+    throw "Open failure";
+  const char *rest = (this->fmode == '+') ? mode + 2 : mode + 1;
+  if (mode[0] == 'w' && *rest == 'c') {
+    // Write into a temporary file; commit() moves it into place
+    this->fd = openTemp(name, flags, &this->tmpName);
+    if (this->fd >= 0) this->target = strdup(name);
+  } else {
+    this->fd = open(name, flags);
   }
   if (this->fd < 0)
     throw "Open failure";
   this->buf = reinterpret_cast<char*>(malloc(bufsiz));
+  if (isatty(this->fd))
+    this->bmode = LINE_BUFFER; // interactive output should appear per line
+}
+
+// Uses the backend in place of a file descriptor
+File::File(Backend *backend, const char *mode) {
+  if (modeFlags(mode, &this->fmode) == -1 || mode[1] == 'c' ||
+      (mode[1] == '+' && mode[2] == 'c'))
+    throw "Open failure";
+  this->fd = -1;
+  this->backend = backend;
+  this->buf = reinterpret_cast<char*>(malloc(bufsiz));
 }
 
 // Frees the buffer and closes the file
 File::~File() {
   try {
+    if (this->target != NULL) this->discard(); // never committed
     this->fflush();
+    if (this->aheadStep > 0) this->trimReserve();
+    delete this->backend;
+    delete this->checksum;
     free(this->buf);
-    int cls = close(this->fd);
-    if (cls == -1)
-      throw "Close failure";
+    if (this->fd >= 0) {
+      int cls = close(this->fd);
+      if (cls == -1)
+        throw "Close failure";
+    }
   }
   catch (...) {
     assert(0);
@@ -63,17 +96,116 @@ bool File::feof() {
 
 
 int File::setvbuf(char *buf, BufferMode mode, size_t size) {
-  assert(0);			// Not implemented.
+  if (size == 0 && (buf != NULL || mode != NO_BUFFER)) return eof;
+  if (this->fflush() != 0) return eof;
+  // An unbuffered file may keep its old buffer: it is simply not used
+  if (buf == NULL && size != 0) {
+    buf = reinterpret_cast<char*>(realloc(this->buf, size));
+    if (buf == NULL) return eof;
+  } else if (buf != NULL && buf != this->buf) {
+    free(this->buf);
+  }
+  if (buf != NULL) {
+    this->buf = buf;
+    this->bufSize = size;
+  }
+  this->bmode = mode;
+  return 0;
+}
+
+
+// True if errno value e means a non-blocking descriptor has no room or
+// no data right now.
+static bool wouldBlock(int e) {
+  return e == EAGAIN || e == EWOULDBLOCK;
+}
+
+
+int File::writeOut(const char *a, size_t alen, const char *b, size_t blen,
+                   size_t *written) {
+  auto writev = [this](const struct iovec *iov, int iovcnt) {
+    return this->rawWritev(iov, iovcnt);
+  };
+  size_t n;
+  int rc = gatherWrite(writev, a, alen, b, blen, &n);
+  if (written != NULL) *written = n;
+  if (rc != 0) {
+    if (this->nonblock && wouldBlock(errno)) this->blocked = POLLOUT;
+    else this->err = -1;
+    return eof;
+  }
+  return 0;
+}
+
+
+// Write out as much of the buffer as possible, keeping whatever could
+// not be written at the front of it.
+int File::pushOut() {
+  size_t written = 0;
+  int rc = this->writeOut(this->buf, this->bufAt, NULL, 0, &written);
+  keepUnwritten(this->buf, &this->bufAt, written);
+  return rc;
+}
+
+
+// Read more data into the buffer after what is already there.  Returns
+// the number of bytes added, 0 at end of file, or -1 on error or if the
+// descriptor would block.
+ssize_t File::fill() {
+  if (this->lastAct != 'r') {
+    this->bufAt = 0;
+    this->bufEnd = 0;
+    this->bufOffset = -1;
+  } else {
+    if (this->writeBack() != 0) return -1;
+    if (this->bufAt > 0) {
+      memmove(this->buf, this->buf + this->bufAt, this->bufEnd - this->bufAt);
+      this->bufEnd -= this->bufAt;
+      if (this->bufOffset >= 0) this->bufOffset += this->bufAt;
+      this->bufAt = 0;
+    }
+  }
+  ssize_t n = this->rawRead(this->buf + this->bufEnd,
+                            this->bufSize - this->bufEnd);
+  if (n < 0) {
+    if (this->nonblock && wouldBlock(errno)) this->blocked = POLLIN;
+    else this->err = -2;
+    return -1;
+  }
+  this->bufEnd += n;
+  if (this->bufEnd > 0) this->lastAct = 'r';
+  return n;
 }
 
 
 int File::fflush() {
+  if (this->flushBuffer() != 0) return eof;
+  if (this->backend != NULL && this->backend->flush() != 0) {
+    this->err = -1;
+    return eof;
+  }
+  return 0;
+}
+
+
+// Empty the buffer when switching between reading and writing or
+// seeking.  Unlike fflush this leaves the backend alone: a backend that
+// holds data (such as a page cache) keeps it until it's really flushed.
+// Before a seek to an absolute position, giveBack is false: the
+// read-ahead is simply dropped, since seeking back over it is wasted
+// (and impossible on backends that can only rewind).
+int File::flushBuffer(bool giveBack) {
+  this->blocked = 0;
   // If the last action was writing, then the buffer needs to be written to file
   if (lastAct == 'w') {
-    if (write(this->fd, this->buf, this->bufAt) < 0)
+    if (this->pushOut() != 0)
       return eof;
   } else if (lastAct == 'r') {
-    if (lseek(this->fd, this->bufAt - this->bufEnd, SEEK_CUR) == (off_t)-1) {
+    if (this->writeBack() != 0)
+      return eof;
+    // Give back the read-ahead
+    if (giveBack && this->bufAt < this->bufEnd &&
+        this->rawSeek(this->bufAt - this->bufEnd, SEEK_CUR) == (off_t)-1) {
       this->err = -4;
       return eof;
     }
@@ -85,101 +217,422 @@ int File::fflush() {
 }
 
 
-size_t File::fread(void *ptr, size_t size, size_t nmemb) {
-  if (this->fmode == 'w') return eof; // stops if file is write only
-  if (this->lastAct == 'w') {
-    if (this->fflush() != 0) // flush if switching between I/O
+// Write the bytes changed in place in the read buffer back to where
+// they came from, leaving the file position where it was.
+int File::writeBack() {
+  if (this->dirtyLo >= this->dirtyHi) return 0;
+  const char *p = this->buf + this->dirtyLo;
+  size_t len = this->dirtyHi - this->dirtyLo;
+  if (this->backend == NULL) {
+    // Without a backend, pwrite saves seeking there and back
+    off_t at = this->bufOffset;
+    if (at < 0) {
+      at = lseek(this->fd, 0, SEEK_CUR);
+      if (at == (off_t)-1) {
+        this->err = -4;
+        return eof;
+      }
+      at -= this->bufEnd;
+      this->bufOffset = at;
+    }
+    at += this->dirtyLo;
+    while (len > 0) {
+      ssize_t n = pwrite(this->fd, p, len, at);
+      if (n < 0) {
+        if (errno == EINTR) continue;
+        this->err = -1;
+        return eof;
+      }
+      p += n;
+      len -= n;
+      at += n;
+    }
+  } else {
+    off_t back = (off_t)this->bufEnd - (off_t)this->dirtyLo;
+    if (this->rawSeek(-back, SEEK_CUR) == (off_t)-1) {
+      this->err = -4;
+      return eof;
+    }
+    if (this->writeOut(p, len, NULL, 0) != 0) return eof;
+    if (this->dirtyHi < this->bufEnd &&
+        this->rawSeek(this->bufEnd - this->dirtyHi, SEEK_CUR) == (off_t)-1) {
+      this->err = -4;
       return eof;
+    }
   }
-  
-  size_t ptrAt = 0;
-  if (this->lastAct == 'r') {
-    // If going to reach end of buffer, empties buffer into ptr
-    if (this->bufAt + size * nmemb > this->bufEnd) {
-      while (bufAt < bufEnd)
-        *(((char *)ptr) + ptrAt++) = *(this->buf + this->bufAt++);
-      if (this->fflush() != 0) {
-        this->bufAt -= ptrAt;
+  this->dirtyLo = 0;
+  this->dirtyHi = 0;
+  return 0;
+}
+
+
+int File::setBackend(Backend *backend) {
+  if (this->fflush() != 0) return eof;
+  delete this->backend;
+  this->backend = backend;
+  return 0;
+}
+
+
+void File::setChecksum(Checksum *checksum) {
+  delete this->checksum;
+  this->checksum = checksum;
+}
+
+
+uint64_t File::digest() {
+  if (this->checksum == NULL) return 0;
+  return this->checksum->digest();
+}
+
+
+// Reads and seeks interrupted by a signal are retried, as writeOut
+// does for writes.
+ssize_t File::rawRead(void *ptr, size_t count) {
+  ssize_t n;
+  do {
+    if (this->backend != NULL) {
+      n = this->backend->read(ptr, count);
+    } else {
+      this->writePos = -1;
+      n = read(this->fd, ptr, count);
+    }
+  } while (n < 0 && errno == EINTR);
+  return n;
+}
+
+
+ssize_t File::rawWritev(const struct iovec *iov, int iovcnt) {
+  if (this->backend != NULL) return this->backend->writev(iov, iovcnt);
+  ssize_t n = writev(this->fd, iov, iovcnt);
+  if (n > 0 && this->aheadStep > 0) this->writeAhead(n);
+  return n;
+}
+
+
+off_t File::rawSeek(off_t offset, int whence) {
+  off_t pos;
+  this->bufOffset = -1;
+  do {
+    if (this->backend != NULL) {
+      pos = this->backend->seek(offset, whence);
+    } else {
+      this->writePos = -1;
+      pos = lseek(this->fd, offset, whence);
+    }
+  } while (pos == (off_t)-1 && errno == EINTR);
+  return pos;
+}
+
+
+void File::writeAhead(ssize_t n) {
+  if (this->writePos < 0) {
+    this->writePos = lseek(this->fd, 0, SEEK_CUR);
+    if (this->writePos < 0) return;
+  } else {
+    this->writePos += n;
+  }
+  off_t step = this->aheadStep;
+  if (this->writePos + step > this->reserved) {
+    // Only a hint: on failure, don't retry until the next step
+    off_t from = (this->reserved > this->writePos) ?
+      this->reserved : this->writePos;
+    this->reserved = this->writePos + 2 * step;
+    fallocate(this->fd, FALLOC_FL_KEEP_SIZE, from, this->reserved - from);
+  }
+  off_t done = this->writePos - this->writePos % step;
+  if (done > this->started) {
+    sync_file_range(this->fd, this->started, done - this->started,
+                    SYNC_FILE_RANGE_WRITE);
+    this->started = done;
+  }
+}
+
+
+int File::trimReserve() {
+  struct stat st;
+  off_t reserved = this->reserved;
+  this->reserved = 0;
+  if (fstat(this->fd, &st) < 0) return -1;
+  if (st.st_size >= reserved) return 0;
+  return ftruncate(this->fd, st.st_size); // frees the blocks past the end
+}
+
+
+int File::sync() {
+  if (this->fflush() != 0) return eof;
+  return this->syncData(false);
+}
+
+
+int File::datasync() {
+  if (this->fflush() != 0) return eof;
+  return this->syncData(true);
+}
+
+
+int File::syncData(bool dataOnly) {
+  int rc = 0;
+  if (this->backend != NULL) {
+    // The backend knows where its data went: maybe not to our fd
+    rc = this->backend->sync(dataOnly);
+  } else if (this->fd >= 0) {
+    rc = dataOnly ? fdatasync(this->fd) : fsync(this->fd);
+  }
+  if (rc < 0) {
+    this->err = -5;
+    return eof;
+  }
+  return 0;
+}
+
+
+int File::commit() {
+  if (this->target == NULL) return eof; // not pending, or already done
+  if (this->aheadStep > 0) {
+    if (this->fflush() != 0) return eof;
+    this->trimReserve();
+  }
+  if (this->sync() != 0) return eof;
+
+  if (this->tmpName == NULL) {
+    // Anonymous file: link it into the directory under a temporary name
+    char proc[32];
+    snprintf(proc, sizeof(proc), "/proc/self/fd/%d", this->fd);
+    size_t len = strlen(this->target) + 32;
+    this->tmpName = reinterpret_cast<char*>(malloc(len));
+    for (int attempt = 0; ; attempt++) {
+      snprintf(this->tmpName, len, "%s.%d.%d", this->target, (int)getpid(),
+               attempt);
+      if (linkat(AT_FDCWD, proc, AT_FDCWD, this->tmpName,
+                 AT_SYMLINK_FOLLOW) == 0)
+        break;
+      if (errno != EEXIST) {
+        free(this->tmpName);
+        this->tmpName = NULL;
+        this->err = -6;
         return eof;
       }
     }
   }
-  if (this->lastAct == '0') { // If no action yet or fflush was last action
-    // If buffer isn't large enough, read directly into ptr
-    if (size * nmemb - ptrAt > bufsiz) {
-      size_t bytes_read = read(this->fd, (void *)((char *)ptr + ptrAt),
-                               nmemb * size);
-      if (bytes_read < 0) {
-        this->err = -3;
-        return eof;
+  if (rename(this->tmpName, this->target) < 0) {
+    this->err = -6;
+    return eof;
+  }
+
+  // Make the rename itself durable
+  char *dir = dirOf(this->target);
+  int dfd = open(dir, O_RDONLY | O_DIRECTORY);
+  free(dir);
+  if (dfd >= 0) {
+    fsync(dfd);
+    close(dfd);
+  }
+  free(this->tmpName);
+  free(this->target);
+  this->tmpName = NULL;
+  this->target = NULL;
+  return 0;
+}
+
+
+int File::discard() {
+  if (this->target == NULL) return eof;
+  this->bufAt = 0;
+  this->bufEnd = 0;
+  this->dirtyLo = 0;
+  this->dirtyHi = 0;
+  this->lastAct = '0';
+  if (this->tmpName != NULL) unlink(this->tmpName);
+  free(this->tmpName);
+  free(this->target);
+  this->tmpName = NULL;
+  this->target = NULL;
+  return 0;
+}
+
+
+int File::fileno() {
+  return this->fd;
+}
+
+
+int File::setNonBlocking(bool on) {
+  int flags = fcntl(this->fd, F_GETFL);
+  if (flags < 0) return eof;
+  flags = on ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+  if (fcntl(this->fd, F_SETFL, flags) < 0) return eof;
+  this->nonblock = on;
+  return 0;
+}
+
+
+int File::wouldblock() {
+  int events = this->blocked;
+  if (this->nonblock && this->lastAct == 'w' && this->bufAt > 0)
+    events |= POLLOUT;		// Buffered output is waiting to drain
+  return events;
+}
+
+
+const char *File::peek(size_t *len) {
+  *len = (this->lastAct == 'r') ? this->bufEnd - this->bufAt : 0;
+  return this->buf + this->bufAt;
+}
+
+
+size_t File::writable() {
+  // Line-buffered and unbuffered writes may go out at once, and a
+  // switch from reading has to reposition the file first.
+  if (this->fmode == 'r' || this->bmode != FULL_BUFFER ||
+      this->lastAct == 'r')
+    return 0;
+  return this->bufSize - this->bufAt;
+}
+
+
+size_t File::fread(void *ptr, size_t size, size_t nmemb) {
+  if (this->fmode == 'w') return eof; // stops if file is write only
+  if (this->lastAct == 'w') {
+    if (this->flushBuffer() != 0) // flush if switching between I/O
+      return eof;
+  }
+  this->blocked = 0;
+
+  char *dst = (char *)ptr;
+  size_t len = size * nmemb;
+  size_t got = 0;
+  // Requests bigger than this skip the buffer
+  size_t limit = (this->bmode == NO_BUFFER) ? 0 : this->bufSize;
+  while (got < len) {
+    if (this->lastAct == 'r' && this->bufAt < this->bufEnd) {
+      // Take what we can from the buffer
+      size_t n = this->bufEnd - this->bufAt;
+      if (n > len - got) n = len - got;
+      memcpy(dst + got, this->buf + this->bufAt, n);
+      this->bufAt += n;
+      got += n;
+      continue;
+    }
+    ssize_t n;
+    if (len - got > limit) {
+      // If buffer isn't large enough (or unbuffered), read directly into ptr
+      if (this->writeBack() != 0) {
+        n = -1;
+      } else {
+        this->bufAt = 0;
+        this->bufEnd = 0;
+        this->lastAct = '0';
+        n = this->rawRead(dst + got, len - got);
+        if (n < 0) {
+          if (this->nonblock && wouldBlock(errno)) this->blocked = POLLIN;
+          else this->err = -3;
+        } else {
+          got += n;
+        }
       }
-      if (bytes_read < size * nmemb - ptrAt) this->end = true;
-      return bytes_read + ptrAt;
     } else { // If buffer is large enough, read into buffer first
-      this->bufEnd = read(this->fd, this->buf, bufsiz);
-      if (this->bufEnd < 0) {
-        this->err = -2;
-	return eof;
-      }
-      if (this->bufEnd == 0) {
-        this->end = true;
-        return ptrAt;
-      }
+      n = this->fill();
     }
-  } 
-  this->lastAct = 'r'; // sets last action to 'r' to check for I/O switch
-
-  while (ptrAt < size * nmemb) {
-    if (this->bufAt == this->bufEnd && this->bufEnd < bufsiz) {
+    if (n == 0) {
       this->end = true;
       break;
     }
-    *(((char *)ptr) + ptrAt++) = *(this->buf + this->bufAt++);
+    if (n < 0) {
+      // Hand over what we have; a would-block is not an error
+      if (got == 0 && this->blocked == 0) return eof;
+      break;
+    }
   }
-  return ptrAt;
+  if (this->checksum != NULL) this->checksum->update(ptr, got);
+  return got;
 }
 
 
 size_t File::fwrite(const void *ptr, size_t size, size_t nmemb) {
   if (this->fmode == 'r') return eof; // stops if file is read only
-  if (this->lastAct == 'r') { 
-    if (this->fflush() != 0) // flushes if switching between I/O
+  const char *src = (const char *)ptr;
+  size_t len = size * nmemb;
+  if (this->lastAct == 'r') {
+    if (len <= this->bufEnd - this->bufAt && this->bmode == FULL_BUFFER &&
+        !this->nonblock) {
+      // Overwrite the read buffer in place; writeBack stores it later
+      if (len == 0) return 0;
+      memcpy(this->buf + this->bufAt, src, len);
+      if (this->dirtyLo == this->dirtyHi || this->bufAt < this->dirtyLo)
+        this->dirtyLo = this->bufAt;
+      this->bufAt += len;
+      if (this->bufAt > this->dirtyHi) this->dirtyHi = this->bufAt;
+      if (this->checksum != NULL) this->checksum->update(src, len);
+      return len;
+    }
+    if (this->flushBuffer() != 0) // flushes if switching between I/O
       return eof;
   }
-  this->lastAct = 'w'; // sets last action to 'w' to check for I/O switch
 
-  size_t bytes_written = 0;
-  if (this->bufAt + size * nmemb > bufsiz) { // checks if write fits in buffer
-    if (this->fflush() != 0) return eof;
-    if (size * nmemb > bufsiz) {
-      bytes_written = write(this->fd, ptr, size * nmemb);
-      if (bytes_written < 0) {
-        this->err = -1;
-        return eof;
-      }
+  this->blocked = 0;
+
+  if (this->nonblock) {
+    // Take only what fits in the buffer, pushing out as much as the
+    // descriptor accepts to make room, so nothing is half-written.
+    size_t taken = 0;
+    this->lastAct = 'w';
+    while (taken < len) {
+      if (this->bufAt == this->bufSize && this->pushOut() != 0) break;
+      size_t n = this->bufSize - this->bufAt;
+      if (n > len - taken) n = len - taken;
+      memcpy(this->buf + this->bufAt, src + taken, n);
+      this->bufAt += n;
+      taken += n;
     }
+    if (this->bmode != FULL_BUFFER && taken > 0) this->pushOut();
+    if (this->checksum != NULL) this->checksum->update(src, taken);
+    if (taken == 0 && this->blocked == 0) return eof;
+    return taken;
+  }
+  // Bytes of src that go straight to the file along with the buffer
+  size_t direct = 0;
+  if (this->bmode == LINE_BUFFER) {
+    const char *nl = findLast(src, len, '\n');
+    if (nl != NULL) direct = nl - src + 1; // everything through the newline
   }
-  if (bytes_written == 0) { // only != 0 if the write won't fit in the buffer
-    for (; bytes_written < size * nmemb; bytes_written++) {
-      *(this->buf + this->bufAt++) = ((char *)ptr)[bytes_written];
+  if (len - direct > this->bufSize || this->bmode == NO_BUFFER)
+    direct = len; // too big to buffer, or not buffering at all
+
+  // Write out the buffer (and the direct part) in one go if needed
+  if (direct > 0 || this->bufAt + len > this->bufSize) {
+    size_t written = 0;
+    int rc = this->writeOut(this->buf, this->bufAt, src, direct, &written);
+    size_t taken = keepUnwritten(this->buf, &this->bufAt, written);
+    if (rc != 0) {
+      // Report any of src that did reach the file, so it isn't repeated
+      if (taken == 0) return eof;
+      if (this->checksum != NULL) this->checksum->update(src, taken);
+      return taken;
     }
   }
-  return bytes_written;
+  if (len > direct) {
+    memcpy(this->buf + this->bufAt, src + direct, len - direct);
+    this->bufAt += len - direct;
+  }
+  this->lastAct = 'w'; // sets last action to 'w' to check for I/O switch
+  if (this->checksum != NULL) this->checksum->update(src, len);
+  return len;
 }
 
 
 int File::fgetc() {
   char temp[1] = {'\0'};
   // checks if file is write only and for I/O switch inside fread call
-  if (this->fread(temp, 1, 1) < 0) return eof;
-  return (int)(*temp);
+  if (this->fread(temp, 1, 1) != 1) return eof;
+  return (unsigned char)(*temp);
 }
 
 
 int File::fputc(int c) {
   char a[1] = {(char)c};
   // checks if file is read only and for I/O switch inside fwrite call
-  if (this->fwrite((void *)a, 1, 1) < 0) return eof;
+  if (this->fwrite((void *)a, 1, 1) != 1) return eof;
   return c;
 }
 
@@ -187,35 +640,140 @@ int File::fputc(int c) {
 char *File::fgets(char *s, int size) {
   if (this->fmode == 'w') return NULL; // stops if file is write only
   if (this->lastAct == 'w') {
-    if (this->fflush() != 0) // flushes if switching between I/O
+    if (this->flushBuffer() != 0) // flushes if switching between I/O
       return NULL;
   }
+  if (size <= 0) return NULL;
+  this->blocked = 0;
 
-  int file_offset = this->bufAt;
-  int overflow = 0;
-  if (this->bufAt == this->bufEnd) overflow++;
-  int temp;
-  int sAt = 0;
-  
-  // reads individual chars until reaching size total chars, a '\n' char, or eof
-  for (int i = 0; i < size; i++) {
-    temp = fgetc();
-    if (this->bufAt == this->bufEnd)
-      overflow++; // count times end of buffer reached
-    if (temp == eof) {
-      if (!this->feof()) {
-        // If an error occurs, empty buffer and reset file to original state
-	this->bufAt = 0;
-	this->bufEnd = 0;
-	this->lastAct = '0';
-        if (lseek(this->fd, file_offset - this->bufEnd - (overflow * bufsiz),
-                  SEEK_CUR) == (off_t)-1)
-          throw "Reposition failure";
-        return NULL;
-      } else break;
-    } else *(s + sAt++) = (char)temp;
-    if (temp == '\n') break;
+  size_t want = size - 1;	// Leave room for the '\0'
+  size_t sAt = 0;
+  if (this->nonblock) {
+    // Only take a line once all of it is in the buffer, so nothing is
+    // lost if the descriptor would block part-way through.  Lines
+    // longer than the buffer are returned a buffer-full at a time.
+    if (want > this->bufSize) want = this->bufSize;
+    for (;;) {
+      sAt = (this->lastAct == 'r') ? this->bufEnd - this->bufAt : 0;
+      if (sAt > want) sAt = want;
+      const char *nl = (const char *)memchr(this->buf + this->bufAt, '\n',
+                                            sAt);
+      if (nl != NULL) {
+        sAt = nl - (this->buf + this->bufAt) + 1;
+        break;
+      }
+      if (sAt == want) break;
+      ssize_t n = this->fill();
+      if (n < 0) return NULL;
+      if (n == 0) {
+        this->end = true;
+        break;
+      }
+    }
+    memcpy(s, this->buf + this->bufAt, sAt);
+    this->bufAt += sAt;
+  } else {
+    // Copy out of the buffer up to a newline, refilling as needed
+    while (sAt < want) {
+      size_t n = (this->lastAct == 'r') ? this->bufEnd - this->bufAt : 0;
+      if (n == 0) {
+        ssize_t got = this->fill();
+        if (got == 0) {
+          this->end = true;
+          break;
+        }
+        if (got < 0) {
+          // If an error occurs, reset file to original state
+          if (sAt > 0 && this->rawSeek(-(off_t)sAt, SEEK_CUR) == (off_t)-1)
+            this->err = -4;
+          return NULL;
+        }
+        continue;
+      }
+      if (n > want - sAt) n = want - sAt;
+      const char *nl = (const char *)memchr(this->buf + this->bufAt, '\n', n);
+      if (nl != NULL) n = nl - (this->buf + this->bufAt) + 1;
+      memcpy(s + sAt, this->buf + this->bufAt, n);
+      this->bufAt += n;
+      sAt += n;
+      if (nl != NULL) break;
+    }
   }
+  if (sAt == 0) return NULL;
+  s[sAt] = '\0';
+  if (this->checksum != NULL) this->checksum->update(s, sAt);
+  return s;
+}
+
+
+int File::getUtf8(wchar_t *c) {
+  if (this->fmode == 'w') return -1; // stops if file is write only
+  if (this->lastAct == 'w') {
+    if (this->flushBuffer() != 0) // flushes if switching between I/O
+      return -1;
+  }
+  this->blocked = 0;
+  // Decode from the buffer, so that nothing is taken until the whole
+  // sequence is there
+  for (;;) {
+    size_t n = (this->lastAct == 'r') ? this->bufEnd - this->bufAt : 0;
+    uint32_t cp = 0;
+    int len = utf8Decode(this->buf + this->bufAt, n, &cp);
+    if (len == 0) {
+      ssize_t got = (n < this->bufSize) ? this->fill() : 0;
+      if (got < 0) return -1;
+      if (got > 0) continue;
+      if (n == 0) {
+        this->end = true;
+        return 0;
+      }
+      len = -(int)n;		// Cut short by end of file
+    }
+    bool bad = (len < 0);
+    if (bad) len = -len;
+    if (this->checksum != NULL)
+      this->checksum->update(this->buf + this->bufAt, len);
+    this->bufAt += len;
+    if (bad) {
+      errno = EILSEQ;
+      return -1;
+    }
+    *c = (wchar_t)cp;
+    return 1;
+  }
+}
+
+
+wint_t File::fgetwc() {
+  wchar_t c;
+  if (this->getUtf8(&c) != 1) return WEOF;
+  return c;
+}
+
+
+wint_t File::fputwc(wchar_t c) {
+  char a[4];
+  int len = utf8Encode((uint32_t)c, a);
+  if (len == 0) {
+    errno = EILSEQ;
+    return WEOF;
+  }
+  if (this->fwrite(a, 1, len) != (size_t)len) return WEOF;
+  return c;
+}
+
+
+wchar_t *File::fgetws(wchar_t *s, int size) {
+  if (size <= 0) return NULL;
+  int i = 0;
+  while (i < size - 1) {
+    int rc = this->getUtf8(&s[i]);
+    if (rc < 0) return NULL;
+    if (rc == 0) break;
+    if (s[i++] == L'\n') break;
+  }
+  if (i == 0) return NULL;
+  s[i] = L'\0';
   return s;
 }
 
@@ -229,14 +787,107 @@ int File::fputs(const char *str) {
 }
 
 
+long File::ftell() {
+  if (this->lastAct == 'r' && this->bufOffset >= 0)
+    return this->bufOffset + this->bufAt;
+  off_t pos = this->rawSeek(0, SEEK_CUR);
+  if (pos == (off_t)-1) return -1;
+  if (this->lastAct == 'r') {
+    this->bufOffset = pos - this->bufEnd;
+    pos -= this->bufEnd - this->bufAt;
+  } else if (this->lastAct == 'w') {
+    pos += this->bufAt;
+  }
+  return pos;
+}
+
+
 int File::fseek(long offset, Whence whence) {
-  this->fflush();
+  if (this->lastAct == 'r' && (whence == seek_set || whence == seek_cur)) {
+    // Just move within the read buffer if the target is in it
+    off_t at = -1;
+    if (whence == seek_cur) {
+      at = (off_t)this->bufAt + offset;
+    } else if (this->ftell() >= 0) {
+      at = offset - this->bufOffset;
+    }
+    if (at >= 0 && at <= (off_t)this->bufEnd) {
+      this->bufAt = at;
+      this->end = false;
+      return 0;
+    }
+  }
+  if (this->flushBuffer(whence == seek_cur) != 0) return -1;
   int where;
   if (whence == seek_set) where = SEEK_SET;
   else if (whence == seek_cur) where = SEEK_CUR;
   else if (whence == seek_end) where = SEEK_END;
+  else if (whence == seek_data) where = SEEK_DATA;
+  else if (whence == seek_hole) where = SEEK_HOLE;
   else return -2; // if (somehow) whence isn't set correctly
-  if (lseek(this->fd, offset, where) == (off_t)-1) return -1;
+  if (this->rawSeek(offset, where) == (off_t)-1) return -1;
+  this->end = false;
+  return 0;
+}
+
+
+int File::punchHole(off_t offset, off_t len) {
+  if (this->fflush() != 0) return eof;
+  if (this->backend != NULL || this->fd < 0) {
+    errno = EOPNOTSUPP;
+    return eof;
+  }
+  if (fallocate(this->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                offset, len) < 0)
+    return eof;
+  return 0;
+}
+
+
+int File::preallocate(off_t offset, off_t len) {
+  if (this->backend != NULL || this->fd < 0) {
+    errno = EOPNOTSUPP;
+    return eof;
+  }
+  if (fallocate(this->fd, FALLOC_FL_KEEP_SIZE, offset, len) < 0)
+    return eof;
+  return 0;
+}
+
+
+int File::setWriteAhead(off_t step) {
+  if (step < 0) return eof;
+  if (this->backend != NULL || this->fd < 0) {
+    errno = EOPNOTSUPP;
+    return eof;
+  }
+  if (this->fflush() != 0) return eof;
+  if (this->aheadStep > 0) this->trimReserve();
+  this->aheadStep = step;
+  this->writePos = -1;
+  if (step > 0) {
+    off_t pos = lseek(this->fd, 0, SEEK_CUR);
+    if (pos < 0) {
+      this->aheadStep = 0;
+      return eof;
+    }
+    this->reserved = pos;
+    this->started = pos - pos % step;
+  }
+  return 0;
+}
+
+
+int File::restoreDefaults() {
+  if (this->err != 0 || this->fflush() != 0) return eof;
+  if (this->backend != NULL && this->setBackend(NULL) != 0) return eof;
+  this->setChecksum(NULL);
+  if (this->nonblock && this->setNonBlocking(false) != 0) return eof;
+  if (this->aheadStep > 0 && this->setWriteAhead(0) != 0) return eof;
+  if (this->bufSize != bufsiz || this->bmode != FULL_BUFFER) {
+    BufferMode mode = isatty(this->fd) ? LINE_BUFFER : FULL_BUFFER;
+    if (this->setvbuf(NULL, mode, bufsiz) != 0) return eof;
+  }
   this->end = false;
   return 0;
 }
@@ -254,11 +905,10 @@ static char *itoa(int i, char a[ITOA_BUFSIZE]) {
     return p;
   }
   bool negative = (i < 0);
-  if (negative) {
-    i = -i;
-  }
-  for (; i > 0; i = i / 10) {
-    *--p = '0' + (i % 10);
+  // Negate as unsigned: -INT_MIN doesn't fit in an int
+  unsigned u = negative ? 0u - (unsigned)i : (unsigned)i;
+  for (; u > 0; u = u / 10) {
+    *--p = '0' + (u % 10);
   }
   if (negative) {
     *--p = '-';
@@ -267,51 +917,137 @@ static char *itoa(int i, char a[ITOA_BUFSIZE]) {
 }
 
 
+// Translate a mode string into open(2) flags and File's fmode
+// character.  Returns -1 if the mode isn't supported.
+static int modeFlags(const char *mode, char *fmode) {
+  if (mode[0] == 'r' && mode[1] == '\0') {
+    *fmode = 'r';
+    return O_RDONLY;
+  } else if (mode[0] == 'w' && (mode[1] == '\0' || mode[1] == 'c')) {
+    *fmode = 'w';
+    return O_WRONLY;
+  } else if ((mode[0] == 'r' || mode[0] == 'w') && mode[1] == '+') {
+    *fmode = '+';
+    return O_RDWR;
+  }
+  return -1;
+}
+
+
+// Return the directory part of name ("." if there is none) in a
+// malloc'd string.
+static char *dirOf(const char *name) {
+  const char *slash = strrchr(name, '/');
+  if (slash == NULL) return strdup(".");
+  if (slash == name) return strdup("/");
+  return strndup(name, slash - name);
+}
+
+
+// Open a file in the same directory as name that nobody else can see:
+// an O_TMPFILE if the file system supports it, otherwise a uniquely
+// named sibling whose malloc'd name is returned in *tmpName.  The new
+// file takes the permissions of name if name already exists.
+static int openTemp(const char *name, int flags, char **tmpName) {
+  int fd = -1;
+  *tmpName = NULL;
+#if defined(O_TMPFILE)
+  char *dir = dirOf(name);
+  fd = open(dir, O_TMPFILE | flags, 0666);
+  free(dir);
+#endif
+  if (fd < 0) {
+    size_t len = strlen(name);
+    *tmpName = reinterpret_cast<char*>(malloc(len + 8));
+    memcpy(*tmpName, name, len);
+    strcpy(*tmpName + len, ".XXXXXX");
+    fd = mkstemp(*tmpName);
+    if (fd < 0) {
+      free(*tmpName);
+      *tmpName = NULL;
+      return -1;
+    }
+    mode_t mask = umask(0);
+    umask(mask);
+    fchmod(fd, 0666 & ~mask);
+  }
+  struct stat st;
+  if (stat(name, &st) == 0) fchmod(fd, st.st_mode & 07777);
+  return fd;
+}
+
+
 // Stripped-down version: only implements %d, %s, and %% format codes.
+// Output is staged on the stack and handed to fwrite in as few pieces as
+// possible.  Unbuffered, it is always handed over whole, so the file
+// sees one write per call: output too big for the stack is staged on
+// the heap instead, since copying it costs less than extra writes.
 int File::fprintf(const char *format, ...) {
+  char stage[bufsiz];
+  char *out = stage;
+  size_t outSize = sizeof(stage);
+  size_t outAt = 0;
+  bool whole = (this->bmode == NO_BUFFER);
   int n = 0;			// Number of characters printed.
   va_list arg_list;
   va_start(arg_list, format);
   for (const char *p = format; *p != '\0'; p++) {
-    if (*p != '%') {
-      if (fputc(*p) < 0) {
-	return -1;
+    const char *s = p;
+    size_t slen = 1;
+    char sbuf[ITOA_BUFSIZE];
+    if (*p == '%') {
+      switch(*++p) {
+      case 's':
+        s = va_arg(arg_list, char *);
+        slen = strlen(s);
+        break;
+      case 'd':
+        s = itoa(va_arg(arg_list, int), sbuf);
+        slen = strlen(s);
+        break;
+      case '\0':
+        p--;  // Lone '%' at the end: print it and stop
+        break;
+      default:
+        s = p;
       }
-      n++;
-      continue;
     }
-    switch(*++p) {
-    case 's':
-      {
-	char *s = va_arg(arg_list, char *);
-	for (;*s != '\0'; s++) {
-	  if (fputc(*s) < 0) {
-	    return -1;
-	  }
-	  n++;
-	}
+    if (outAt + slen > outSize && whole) {
+      // Grow the staging area onto the heap
+      size_t size = outSize * 2;
+      while (size < outAt + slen) size *= 2;
+      char *bigger = (char *)malloc(size);
+      if (bigger == NULL) {
+        n = -1;
+        break;
       }
-      break;
-    case 'd':
-      {
-	int i = va_arg(arg_list, int);
-	char sbuf[ITOA_BUFSIZE];
-	char *s = itoa(i, sbuf);
-	for (;*s != '\0'; s++) {
-	  if (fputc(*s) < 0) {
-	    return -1;
-	  }
-	  n++;
-	}
+      memcpy(bigger, out, outAt);
+      if (out != stage) free(out);
+      out = bigger;
+      outSize = size;
+    }
+    // Hand the staging area to fwrite when the next piece doesn't fit
+    if (outAt + slen > outSize && outAt > 0) {
+      if (this->fwrite(out, 1, outAt) != outAt) {
+        n = -1;
+        break;
       }
-      break;
-    default:
-      if (fputc(*p) < 0) {
-	return -1;
+      outAt = 0;
+    }
+    if (slen > outSize) {
+      if (this->fwrite(s, 1, slen) != slen) {
+        n = -1;
+        break;
       }
-      n++;
+    } else {
+      memcpy(out + outAt, s, slen);
+      outAt += slen;
     }
+    n += slen;
   }
   va_end(arg_list);
+  if (n >= 0 && outAt > 0 && this->fwrite(out, 1, outAt) != outAt)
+    n = -1;
+  if (out != stage) free(out);
   return n;
 }
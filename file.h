@@ -12,7 +12,13 @@
 #define FILE_H
 
 #include <cstddef>
+#include <cwchar>
 #include <exception>
+#include <stdint.h>
+#include <sys/types.h>
+
+class Backend;
+class Checksum;
 
 
 class File {
@@ -27,11 +33,15 @@ public:
   };
 
   // Use lowercase because system header files #define the uppercase
-  // names.
+  // names.  seek_data and seek_hole move to the first data or hole at
+  // or after offset (an absolute position), as for lseek(2); seeking
+  // for data past the last data fails with errno ENXIO.
   enum Whence {
     seek_set,
     seek_cur,
-    seek_end
+    seek_end,
+    seek_data,
+    seek_hole
   };
 
   static const int bufsiz = 8192;
@@ -40,9 +50,17 @@ public:
   // Open a file.
   // Mode can be "r", "r+", "w", "w+",
   // Modes "a", and "a+" are unsupported.
-  // Use default buffering: FULL_BUFFER.
+  // Modes "wc" and "w+c" write into a temporary file that atomically
+  // replaces name when commit() is called, and is discarded otherwise.
+  // Use default buffering: FULL_BUFFER, or LINE_BUFFER if the file is
+  // a terminal.
   File(const char *name, const char *mode = "r");
 
+  // Read and write through backend rather than a named file; the File
+  // takes ownership of it.  Mode as above, except "wc" and "w+c".
+  // There is no file descriptor: fileno() returns -1.
+  File(Backend *backend, const char *mode = "r");
+
   // Close the file.  Make sure any buffered data is written to disk,
   // and free the buffer if there is one.
   ~File();
@@ -58,8 +76,12 @@ public:
 
   // Add a user-defined buffer and set the buffering mode.  If
   // non-null, the buffer must have been created by malloc and will be
-  // freed by the destructor (or by another call to setvbuf).
-  // LINE_BUFFER mode need not be supported.
+  // freed by the destructor (or by another call to setvbuf).  If
+  // null, the current buffer is resized to size bytes.
+  // In LINE_BUFFER mode, written data is flushed up to and including
+  // the last newline of each write; the rest stays buffered.  In
+  // NO_BUFFER mode, each fwrite, fputs or fprintf call is passed to the
+  // system as a single write.
   int setvbuf(char *buf, BufferMode mode, size_t size);
 
   // If data is buffered for writing, write the buffered data to
@@ -67,26 +89,126 @@ public:
   // behaves the way the user would expect.
   int fflush();
 
+  // Route all reads, writes and seeks through backend instead of the
+  // file descriptor, e.g. to encrypt the data.  The File takes
+  // ownership of backend and deletes it when closed or replaced.
+  int setBackend(Backend *backend);
+
+  // From now on, add every byte passed to or returned by fread and
+  // fwrite (and so fgetc, fputc, fgets, fputs and fprintf) to checksum,
+  // which the File takes ownership of.  Null stops checksumming.
+  // digest returns the checksum so far, or 0 if there is none.
+  void setChecksum(Checksum *checksum);
+  uint64_t digest();
+
+  // Flush, then force the file's data to stable storage.  sync uses
+  // fsync; datasync uses fdatasync, which skips metadata (such as the
+  // modification time) that isn't needed to read the data back.  With
+  // a backend, the backend's sync does this (see backend.h).
+  int sync();
+  int datasync();
+
+  // For "wc" and "w+c" files: make the data durable and atomically
+  // rename it into place, or throw it away.  The destructor discards
+  // an uncommitted file.  After either call, further writes go to the
+  // (committed or discarded) file as usual.
+  int commit();
+  int discard();
+
+  // Return the underlying file descriptor.
+  int fileno();
+
+  // Put the descriptor in (or take it out of) non-blocking mode, for
+  // driving the File from an event loop.  When the descriptor has no
+  // data or no room, fread, fwrite and fgets return early (fread and
+  // fwrite with a short count, fgets with NULL) without losing any
+  // buffered data and without setting an error.  fwrite accepts only
+  // what fits in the buffer, and fgets returns a line only once all of
+  // it has arrived.
+  int setNonBlocking(bool on);
+
+  // Return the poll events (POLLIN, POLLOUT) the File is waiting for:
+  // what the last call would have blocked on, plus POLLOUT while
+  // buffered output is still waiting to be written.  0 means there is
+  // nothing to wait for.
+  int wouldblock();
+
+  // The data already buffered for reading (valid until the next call
+  // on the File), and the number of bytes fwrite can take without doing
+  // any I/O.  Lets callers such as the async API skip work that the
+  // buffer can satisfy on its own.
+  const char *peek(size_t *len);
+  size_t writable();
+
   // If the amount of data to be read or written exceeds the buffer,
   // avoid double-buffering by reading/writing data directly to/from
   // the source/destination.
+  // On a file open for both, a fully buffered write that lands within
+  // data already read into the buffer just changes the buffer; the
+  // changed bytes are written back when the buffer is refilled or
+  // flushed.  So reads and writes (and seeks, below) can alternate
+  // within the buffer without any system calls.
+  // If writing fails part way through, fwrite returns the number of
+  // bytes that did reach the file (eof if none), and keeps buffered
+  // bytes that didn't for the next flush, so nothing is written twice.
   size_t fread(void *ptr, size_t size, size_t nmemb);
   size_t fwrite(const void *ptr, size_t size, size_t nmemb);
 
   int fgetc();
   int fputc(int c);
 
+  // Read at most size - 1 characters, stopping after a newline, and
+  // terminate them with '\0'.  Return NULL at end of file or on error.
   char *fgets(char *s, int size);
   int fputs(const char *str);
 
-  // Flush any buffered data and reset the file pointer.
+  // Read and write characters encoded as UTF-8, whatever the locale.
+  // An invalid or truncated sequence is skipped and reported by
+  // returning WEOF (NULL for fgetws) with errno set to EILSEQ; the File
+  // stays usable.  fputwc fails the same way on a surrogate or a value
+  // past U+10FFFF.  fgetws reads at most size - 1 characters, stopping
+  // after a newline, and terminates them with L'\0'.
+  wint_t fgetwc();
+  wint_t fputwc(wchar_t c);
+  wchar_t *fgetws(wchar_t *s, int size);
+
+  // Flush any buffered data and reset the file pointer.  A seek_set or
+  // seek_cur to a position within the data read into the buffer just
+  // moves within it.
   int fseek(long offset, Whence whence);
 
+  // Return the current position, counting buffered data, or -1.
+  long ftell();
+
+  // Deallocate len bytes at offset: they read back as zeros but take
+  // no disk space.  The file size is unchanged.  Flushes first.
+  int punchHole(off_t offset, off_t len);
+
+  // Reserve disk space for len bytes at offset without changing the
+  // file size, so that a writer filling the range sequentially gets
+  // contiguous blocks and doesn't stall allocating them.
+  // Both need a plain file descriptor: they fail with EOPNOTSUPP on a
+  // File with a backend.
+  int preallocate(off_t offset, off_t len);
+
+  // For large sequential writers: as writes advance, keep disk space
+  // reserved step bytes ahead (in step-sized fallocate calls) and start
+  // writeback of each completed step-sized region with
+  // sync_file_range, so the kernel never has a large backlog of dirty
+  // pages to write at once.  Space reserved past the end of the file is
+  // released on close, commit(), or setWriteAhead(0), which turns this
+  // off.  Needs a plain file descriptor, as above.
+  int setWriteAhead(off_t step);
+
   // Stripped-down version: only implements %d and %s format codes.
   int fprintf(const char *format, ...);
 
 private:
+  friend class FileCache;
+  friend class GroupCommit;
+
   char *buf;
+  size_t bufSize = bufsiz;
   size_t bufAt = 0;
   size_t bufEnd = 0;
   BufferMode bmode = FULL_BUFFER;
@@ -95,6 +217,50 @@ private:
   int fd;
   int err = 0;
   bool end = false;
+  char *target = NULL;   // Name to commit to, for "wc" and "w+c"
+  char *tmpName = NULL;  // Temporary name, if not an anonymous file
+  Backend *backend = NULL;
+  Checksum *checksum = NULL;
+  bool nonblock = false;
+  int blocked = 0;       // Poll events the last call would have waited on
+  size_t dirtyLo = 0;    // Bytes of the read buffer changed by fwrite
+  size_t dirtyHi = 0;
+  off_t bufOffset = -1;  // File offset of buf[0] while reading, if known
+  off_t aheadStep = 0;   // setWriteAhead step, 0 if off
+  off_t writePos = -1;   // Descriptor offset after the last write, if known
+  off_t reserved = 0;    // Space is preallocated up to here
+  off_t started = 0;     // Writeback has been started up to here
+
+  // Write a, then b, with as few system calls as possible.  If given,
+  // *written is set to the number of bytes written, even on failure.
+  int writeOut(const char *a, size_t alen, const char *b, size_t blen,
+               size_t *written = NULL);
+  int pushOut();
+  int flushBuffer(bool giveBack = true);
+  // The part of sync and datasync after the flush, which GroupCommit
+  // does for many Files at once.  Sets err to -5 on failure.
+  int syncData(bool dataOnly);
+  ssize_t fill();
+  int writeBack();
+  // Decode the next character into *c.  Return 1, 0 at end of file, or
+  // -1 on error or an invalid sequence.
+  int getUtf8(wchar_t *c);
+
+  // The file descriptor, or the backend if there is one.
+  ssize_t rawRead(void *ptr, size_t count);
+  ssize_t rawWritev(const struct iovec *iov, int iovcnt);
+  off_t rawSeek(off_t offset, int whence);
+
+  // Called after n bytes are written to the descriptor with write-ahead
+  // on.  trimReserve releases preallocated space past the end of file;
+  // if that fails, the space just stays allocated.
+  void writeAhead(ssize_t n);
+  int trimReserve();
+
+  // Flush, then undo any setBackend, setChecksum, setNonBlocking,
+  // setWriteAhead or setvbuf, so the File is as if just opened.  Fails
+  // if the File is in an error state.
+  int restoreDefaults();
 
   // Disallow copy & assignment.
   File(File const&) = delete;
@@ -0,0 +1,133 @@
+//
+// file_cache.cc
+//
+// Keep recently used Files open for reuse.
+//
+
+
+#include "file_cache.h"
+#include "file.h"
+
+#include <algorithm>
+
+
+FileCache::Handle::Handle(Handle &&other)
+  : cache(other.cache), file(other.file), key(std::move(other.key)) {
+  other.file = nullptr;
+}
+
+
+FileCache::Handle::~Handle() {
+  if (this->file != nullptr) this->cache->release(this->file, this->key);
+}
+
+
+FileCache::FileCache(size_t maxOpen, std::chrono::seconds idleTimeout)
+  : maxOpen(maxOpen > 0 ? maxOpen : 1), idleTimeout(idleTimeout) {
+  this->reaper = std::thread(&FileCache::reap, this);
+}
+
+
+FileCache::~FileCache() {
+  {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    this->stopping = true;
+  }
+  this->wake.notify_one();
+  this->reaper.join();
+  for (Entry &entry : this->lru) delete entry.file;
+}
+
+
+FileCache::Handle FileCache::open(const char *name, const char *mode) {
+  std::string key = std::string(mode) + ":" + name;
+  std::vector<File *> closing;
+  std::unique_lock<std::mutex> lock(this->mtx);
+
+  auto found = this->idle.find(key);
+  if (found != this->idle.end() && !found->second.empty()) {
+    EntryRef entry = found->second.back();
+    File *file = this->evict(entry);
+    this->inUse++;
+    lock.unlock();
+    file->fseek(0, File::seek_set);
+    return Handle(this, file, key);
+  }
+
+  // Make room for a new File
+  for (;;) {
+    while (this->inUse + this->lru.size() >= this->maxOpen &&
+           !this->lru.empty())
+      closing.push_back(this->evict(std::prev(this->lru.end())));
+    if (this->inUse + this->lru.size() < this->maxOpen) break;
+    this->released.wait(lock);
+  }
+  this->inUse++;
+  lock.unlock();
+
+  for (File *file : closing) delete file;
+  try {
+    return Handle(this, new File(name, mode), key);
+  } catch (...) {
+    lock.lock();
+    this->inUse--;
+    lock.unlock();
+    this->released.notify_one();
+    throw;
+  }
+}
+
+
+void FileCache::release(File *file, const std::string &key) {
+  // A File that can't be put back as if just opened isn't reused
+  if (file->restoreDefaults() != 0) {
+    delete file;
+    {
+      std::lock_guard<std::mutex> lock(this->mtx);
+      this->inUse--;
+    }
+    this->released.notify_one();
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    Entry entry = {key, file, std::chrono::steady_clock::now()};
+    this->lru.push_front(entry);
+    this->idle[key].push_back(this->lru.begin());
+    this->inUse--;
+  }
+  this->released.notify_one();
+}
+
+
+// Take an idle entry out of the cache (with the lock held) and return
+// its File.
+File *FileCache::evict(EntryRef entry) {
+  File *file = entry->file;
+  auto found = this->idle.find(entry->key);
+  std::vector<EntryRef> &refs = found->second;
+  refs.erase(std::find(refs.begin(), refs.end(), entry));
+  if (refs.empty()) this->idle.erase(found);
+  this->lru.erase(entry);
+  return file;
+}
+
+
+// Close Files that have been idle too long.
+void FileCache::reap() {
+  std::vector<File *> closing;
+  std::unique_lock<std::mutex> lock(this->mtx);
+  while (!this->stopping) {
+    this->wake.wait_for(lock, this->idleTimeout / 2 +
+                                std::chrono::milliseconds(1));
+    auto cutoff = std::chrono::steady_clock::now() - this->idleTimeout;
+    while (!this->lru.empty() && this->lru.back().used <= cutoff)
+      closing.push_back(this->evict(std::prev(this->lru.end())));
+    if (closing.empty()) continue;
+    lock.unlock();
+    for (File *file : closing) delete file;
+    closing.clear();
+    lock.lock();
+    this->released.notify_all();
+  }
+}
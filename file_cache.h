@@ -0,0 +1,97 @@
+//
+// file_cache.h
+//
+// Keep recently used Files open for reuse, for workloads that open and
+// close the same files over and over.  Opening a cached file costs a
+// hash lookup and a seek instead of open(2) plus a buffer allocation.
+//
+// At most maxOpen Files are open at once; when the limit is reached the
+// least recently used idle File is closed, and if every File is in use
+// open() waits for one to be released.  A background thread closes
+// Files that have sat idle for longer than the idle timeout.
+//
+// Not for "wc"/"w+c" Files, whose lifetime decides whether they commit.
+//
+
+#if !defined(FILE_CACHE_H)
+#define FILE_CACHE_H
+
+#include <chrono>
+#include <condition_variable>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+class File;
+
+
+class FileCache {
+public:
+  // A File borrowed from the cache; returned to it when destroyed.
+  class Handle {
+  public:
+    Handle(Handle &&other);
+    ~Handle();
+
+    File *operator->() { return this->file; }
+    File &operator*() { return *this->file; }
+
+  private:
+    friend class FileCache;
+    FileCache *cache;
+    File *file;
+    std::string key;
+
+    Handle(FileCache *cache, File *file, const std::string &key)
+      : cache(cache), file(file), key(key) {}
+    Handle(Handle const&) = delete;
+    Handle& operator=(Handle const&) = delete;
+  };
+
+  explicit FileCache(size_t maxOpen = 1024,
+                     std::chrono::seconds idleTimeout =
+                       std::chrono::seconds(30));
+  // Closes every idle File.  All Handles must have been released.
+  ~FileCache();
+
+  // Like File(name, mode), but reuses an idle File for the same name and
+  // mode if there is one (positioned at the start, as if just opened).
+  // A File returned in an error state is closed rather than reused, and
+  // any backend, checksum, non-blocking mode, write-ahead or buffer
+  // setting is undone before it goes back in the cache.
+  // Throws as File does if the file can't be opened.
+  Handle open(const char *name, const char *mode = "r");
+
+private:
+  struct Entry {
+    std::string key;
+    File *file;
+    std::chrono::steady_clock::time_point used;
+  };
+  typedef std::list<Entry>::iterator EntryRef;
+
+  size_t maxOpen;
+  std::chrono::seconds idleTimeout;
+  std::mutex mtx;
+  std::condition_variable released;
+  std::condition_variable wake;
+  std::list<Entry> lru;   // Idle Files, most recently used first
+  std::unordered_map<std::string, std::vector<EntryRef>> idle;
+  size_t inUse = 0;
+  bool stopping = false;
+  std::thread reaper;
+
+  void release(File *file, const std::string &key);
+  File *evict(EntryRef entry);
+  void reap();
+
+  // Disallow copy & assignment.
+  FileCache(FileCache const&) = delete;
+  FileCache& operator=(FileCache const&) = delete;
+};
+
+
+#endif
@@ -0,0 +1,147 @@
+//
+// follow_backend.cc
+//
+// A read-only Backend that follows a growing file like "tail -f",
+// waiting on inotify at end-of-file.
+//
+
+
+#include "follow_backend.h"
+
+#include <fcntl.h>	// open
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>	// fstat
+#include <unistd.h>	// read, close, dup
+#include <stdint.h>
+#include <string.h>	// strcmp
+#include <errno.h>
+
+static const uint32_t FILE_EVENTS = IN_MODIFY | IN_MOVE_SELF |
+                                    IN_DELETE_SELF | IN_ATTRIB;
+static const uint32_t DIR_EVENTS = IN_CREATE | IN_MOVED_TO;
+
+
+FollowBackend::FollowBackend(int fd, const char *path) : path(path) {
+  size_t slash = this->path.rfind('/');
+  std::string dir;
+  if (slash == std::string::npos) {
+    dir = ".";
+    this->name = this->path;
+  } else {
+    dir = slash == 0 ? "/" : this->path.substr(0, slash);
+    this->name = this->path.substr(slash + 1);
+  }
+  this->fd = dup(fd);
+  this->stopFd = eventfd(0, EFD_CLOEXEC);
+  this->notifyFd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+  this->fileWatch = inotify_add_watch(this->notifyFd, path, FILE_EVENTS);
+  this->dirWatch = inotify_add_watch(this->notifyFd, dir.c_str(), DIR_EVENTS);
+}
+
+
+FollowBackend::~FollowBackend() {
+  close(this->notifyFd);
+  close(this->stopFd);
+  close(this->fd);
+}
+
+
+void FollowBackend::stop() {
+  uint64_t one = 1;
+  while (::write(this->stopFd, &one, sizeof(one)) < 0 && errno == EINTR) {
+  }
+}
+
+
+ssize_t FollowBackend::write(const void *, size_t) {
+  errno = EBADF;
+  return -1;
+}
+
+
+off_t FollowBackend::seek(off_t offset, int whence) {
+  return lseek(this->fd, offset, whence);
+}
+
+
+ssize_t FollowBackend::read(void *buf, size_t count) {
+  for (;;) {
+    ssize_t n = ::read(this->fd, buf, count);
+    if (n != 0 || count == 0) return n;
+
+    // At end of file.  Start over if the file was truncated under us.
+    struct stat st;
+    off_t at = lseek(this->fd, 0, SEEK_CUR);
+    if (fstat(this->fd, &st) == 0 && at > st.st_size) {
+      lseek(this->fd, 0, SEEK_SET);
+      continue;
+    }
+    // The old file is drained; move on to its replacement if it exists.
+    if (this->replaced && this->reopen() == 0) continue;
+    if (this->stopped) return 0;
+    if (this->wait() != 0) return -1;
+  }
+}
+
+
+// Block until the file changes or stop() is called, then note what
+// happened.  Returns 0, or -1 on error.
+int FollowBackend::wait() {
+  struct pollfd fds[2];
+  fds[0].fd = this->notifyFd;
+  fds[0].events = POLLIN;
+  fds[1].fd = this->stopFd;
+  fds[1].events = POLLIN;
+  if (poll(fds, 2, -1) < 0) return errno == EINTR ? 0 : -1;
+  if (fds[1].revents & POLLIN) {
+    this->stopped = true;
+    return 0;		// Let read drain what's left before stopping
+  }
+
+  char events[4096]
+    __attribute__((aligned(__alignof__(struct inotify_event))));
+  for (;;) {
+    ssize_t len = ::read(this->notifyFd, events, sizeof(events));
+    if (len <= 0) break;	// EAGAIN: all events consumed
+    for (char *p = events; p < events + len; ) {
+      struct inotify_event *ev = (struct inotify_event *)p;
+      if (ev->wd == this->fileWatch &&
+          (ev->mask & (IN_MOVE_SELF | IN_DELETE_SELF)))
+        this->replaced = true;
+      if (ev->wd == this->dirWatch && ev->len > 0 &&
+          strcmp(ev->name, this->name.c_str()) == 0)
+        this->replaced = true;
+      p += sizeof(struct inotify_event) + ev->len;
+    }
+  }
+  return 0;
+}
+
+
+// Switch to the file now at path.  Returns -1 if there isn't one yet.
+int FollowBackend::reopen() {
+  int next = open(this->path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (next < 0) return -1;
+  struct stat was, now;
+  if (fstat(this->fd, &was) == 0 && fstat(next, &now) == 0 &&
+      was.st_dev == now.st_dev && was.st_ino == now.st_ino) {
+    close(next);		// Same file after all (e.g. touched)
+    this->replaced = false;
+    return -1;
+  }
+  inotify_rm_watch(this->notifyFd, this->fileWatch);
+  this->fileWatch = inotify_add_watch(this->notifyFd, this->path.c_str(),
+                                      FILE_EVENTS);
+  close(this->fd);
+  this->fd = next;
+  this->replaced = false;
+  return 0;
+}
+
+
+// Read-only: nothing written to sync.
+int FollowBackend::sync(bool) {
+  return 0;
+}
@@ -0,0 +1,59 @@
+//
+// follow_backend.h
+//
+// A read-only Backend that follows a growing file like "tail -f".
+// Instead of returning end-of-file, a read waits for more data to be
+// appended, using inotify so nothing is polled.  Truncation restarts
+// reading from the beginning, and if the file is renamed or deleted
+// (log rotation) the rest of the old file is read before switching to
+// the new file created under the same name.
+//
+// stop() (from any thread) ends following: reads then return
+// end-of-file as usual once the data already present is consumed.
+//
+
+#if !defined(FOLLOW_BACKEND_H)
+#define FOLLOW_BACKEND_H
+
+#include "backend.h"
+
+#include <string>
+
+
+class FollowBackend: public Backend {
+public:
+  // fd is the File's descriptor for path; the backend reads through its
+  // own duplicate.
+  FollowBackend(int fd, const char *path);
+  ~FollowBackend();
+
+  // Make waiting and future reads return end-of-file.
+  void stop();
+
+  ssize_t read(void *buf, size_t count);
+  // Writing fails with EBADF.
+  ssize_t write(const void *buf, size_t count);
+  off_t seek(off_t offset, int whence);
+  int sync(bool dataOnly);
+
+private:
+  std::string path;
+  std::string name;       // Last component of path
+  int fd;
+  int notifyFd;
+  int fileWatch = -1;
+  int dirWatch = -1;
+  int stopFd;             // eventfd signalled by stop()
+  bool replaced = false;  // Has path been renamed, deleted or recreated?
+  bool stopped = false;
+
+  int wait();
+  int reopen();
+
+  // Disallow copy & assignment.
+  FollowBackend(FollowBackend const&) = delete;
+  FollowBackend& operator=(FollowBackend const&) = delete;
+};
+
+
+#endif
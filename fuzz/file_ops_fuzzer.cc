@@ -0,0 +1,210 @@
+//
+// file_ops_fuzzer.cc
+//
+// Coverage-guided fuzz target: each input is a script of fread, fwrite,
+// fgets, fgetc, fputc, fseek, ftell, fflush and fprintf calls, run on a
+// File over a MemoryBackend and on a reference model (a string and a
+// position).  Any difference in returned bytes, positions or the final
+// contents aborts.
+//
+// With libFuzzer (clang), or AFL++ through its libFuzzer driver:
+//
+//     clang++ -std=c++11 -g -O1 -fsanitize=fuzzer,address,undefined -I.
+//         -o file_ops_fuzzer fuzz/file_ops_fuzzer.cc file.cc
+//         memory_backend.cc newline_backend.cc page_cache_backend.cc
+//         checksum.cc scan.cc utf8.cc
+//     ./file_ops_fuzzer fuzz/corpus/file_ops
+//
+// Offline, without a fuzzing engine, build with -DFUZZ_STANDALONE (any
+// compiler) to replay the checked-in corpus or a crash file.  "make
+// test" builds it that way and replays the corpus:
+//
+//     _build/fuzz/file_ops_fuzzer fuzz/corpus/file_ops/*
+//
+// Script format: the first byte picks the buffering (mode and size);
+// then each op is one byte, op % 10, followed by its arguments.
+// Arguments past the end of the input read as zero.
+//
+
+
+#include "file.h"
+#include "memory_backend.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+
+
+namespace {
+
+// Reads the script, yielding zeros once it runs out.
+class Script {
+public:
+  Script(const uint8_t *data, size_t size) : data(data), size(size) {}
+
+  bool done() {
+    return this->at >= this->size;
+  }
+  uint8_t byte() {
+    return (this->at < this->size) ? this->data[this->at++] : 0;
+  }
+  unsigned word() {
+    unsigned hi = this->byte();
+    return (hi << 8) | this->byte();
+  }
+  // A length: usually small, sometimes bigger than any buffer.
+  size_t length() {
+    uint8_t b = this->byte();
+    return (b & 0x80) ? (size_t)(b & 0x7f) * 257 : b;
+  }
+
+private:
+  const uint8_t *data;
+  size_t size;
+  size_t at = 0;
+};
+
+
+void check(bool ok, const char *what) {
+  if (!ok) {
+    fprintf(stderr, "file_ops_fuzzer: %s differs from the model\n", what);
+    abort();
+  }
+}
+
+}  // namespace
+
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  Script in(data, size);
+  MemoryBackend *mem = new MemoryBackend();
+  File f(mem, "w+");
+  std::string model;
+  size_t pos = 0;
+
+  uint8_t setup = in.byte();
+  size_t bufSize = 1 + (setup >> 2) * 4;
+  if ((setup & 3) == 1) f.setvbuf(NULL, File::FULL_BUFFER, bufSize);
+  if ((setup & 3) == 2) f.setvbuf(NULL, File::LINE_BUFFER, bufSize);
+  if ((setup & 3) == 3) f.setvbuf(NULL, File::NO_BUFFER, 0);
+
+  char buf[32768 + 1];
+  for (int steps = 0; !in.done() && steps < 10000; steps++) {
+    switch (in.byte() % 10) {
+    case 0: {			// fwrite, data from the script
+      size_t n = in.length();
+      for (size_t i = 0; i < n; i++) buf[i] = in.byte();
+      check(f.fwrite(buf, 1, n) == n, "fwrite count");
+      if (n > 0) {		// Writing nothing doesn't extend the file
+        if (model.size() < pos + n) model.resize(pos + n);
+        model.replace(pos, n, buf, n);
+        pos += n;
+      }
+      break;
+    }
+    case 1: {			// fread
+      size_t n = in.length();
+      size_t want = (pos < model.size()) ? std::min(n, model.size() - pos) : 0;
+      size_t got = f.fread(buf, 1, n);
+      check(got == want &&
+            (want == 0 || model.compare(pos, want, buf, want) == 0),
+            "fread");
+      pos += want;
+      break;
+    }
+    case 2: {			// fgets
+      int n = 2 + in.byte();
+      size_t want = (pos < model.size())
+                      ? std::min((size_t)n - 1, model.size() - pos) : 0;
+      size_t nl = model.find('\n', pos);
+      if (nl != std::string::npos && nl < pos + want) want = nl + 1 - pos;
+      char *s = f.fgets(buf, n);
+      // fgets returns a C string, so an embedded NUL ends the comparison
+      if (want == 0) {
+        check(s == NULL, "fgets at end of file");
+      } else {
+        check(s != NULL && memcmp(s, model.data() + pos, want) == 0,
+              "fgets");
+      }
+      pos += want;
+      break;
+    }
+    case 3: {			// fgetc
+      int want = (pos < model.size()) ? (unsigned char)model[pos++]
+                                      : File::eof;
+      check(f.fgetc() == want, "fgetc");
+      break;
+    }
+    case 4: {			// fputc
+      int c = in.byte();
+      check(f.fputc(c) == c, "fputc");
+      if (model.size() < pos + 1) model.resize(pos + 1);
+      model[pos++] = (char)c;
+      break;
+    }
+    case 5: {			// fseek anywhere up to a little past the end
+      int whence = in.byte() % 3;
+      long to = in.word() % (model.size() + 17);
+      long offset = to;
+      if (whence == File::seek_cur) offset = to - (long)pos;
+      if (whence == File::seek_end) offset = to - (long)model.size();
+      check(f.fseek(offset, (File::Whence)whence) == 0, "fseek");
+      pos = to;
+      break;
+    }
+    case 6:			// fseek before the start fails
+      check(f.fseek(-1 - (long)in.byte() - (long)pos, File::seek_cur) != 0,
+            "fseek before the start");
+      break;
+    case 7:
+      check(f.ftell() == (long)pos, "ftell");
+      break;
+    case 8:
+      check(f.fflush() == 0, "fflush");
+      break;
+    case 9: {			// fprintf
+      int d = (int)(in.word() << 16 | in.word());
+      char s[8];
+      size_t n = in.byte() % sizeof(s);
+      for (size_t i = 0; i < n; i++) s[i] = 'a' + in.byte() % 26;
+      s[n] = '\0';
+      int len = snprintf(buf, sizeof(buf), "%d|%s\n", d, s);
+      check(f.fprintf("%d|%s\n", d, s) == len, "fprintf count");
+      if (model.size() < pos + len) model.resize(pos + len);
+      model.replace(pos, len, buf, len);
+      pos += len;
+      break;
+    }
+    }
+  }
+
+  check(f.fflush() == 0 && f.ferror() == 0, "final fflush");
+  check(f.ftell() == (long)pos, "final ftell");
+  check(mem->contents() == model, "file contents");
+  return 0;
+}
+
+
+#if defined(FUZZ_STANDALONE)
+// Replay each file named on the command line.
+int main(int argc, char **argv) {
+  for (int i = 1; i < argc; i++) {
+    FILE *in = fopen(argv[i], "rb");
+    if (in == NULL) {
+      perror(argv[i]);
+      return 1;
+    }
+    std::string data;
+    char b[4096];
+    size_t n;
+    while ((n = fread(b, 1, sizeof(b), in)) > 0) data.append(b, n);
+    fclose(in);
+    LLVMFuzzerTestOneInput((const uint8_t *)data.data(), data.size());
+  }
+  printf("%d inputs ran\n", argc - 1);
+  return 0;
+}
+#endif
@@ -0,0 +1,85 @@
+//
+// group_commit.cc
+//
+// Batch durability requests from many Files and threads so that each
+// file is synced once per commit interval instead of once per record.
+//
+
+
+#include "group_commit.h"
+#include "file.h"
+
+#include <fcntl.h>	// sync_file_range
+
+
+GroupCommit::GroupCommit(std::chrono::microseconds interval, bool dataOnly)
+  : interval(interval), dataOnly(dataOnly) {
+  this->worker = std::thread(&GroupCommit::run, this);
+}
+
+
+GroupCommit::~GroupCommit() {
+  {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    this->stopping = true;
+  }
+  this->work.notify_one();
+  this->worker.join();
+}
+
+
+int GroupCommit::sync(File &file) {
+  if (file.fflush() != 0) return File::eof;
+  Request req = {&file, 0, false};
+  std::unique_lock<std::mutex> lock(this->mtx);
+  this->pending.push_back(&req);
+  if (this->pending.size() == 1) this->work.notify_one();
+  this->finished.wait(lock, [&req] { return req.done; });
+  return req.result;
+}
+
+
+void GroupCommit::run() {
+  std::vector<Request *> batch;
+  std::unique_lock<std::mutex> lock(this->mtx);
+  for (;;) {
+    this->work.wait(lock, [this] {
+      return this->stopping || !this->pending.empty();
+    });
+    if (this->pending.empty()) break; // stopping with nothing left to do
+    // Let the group fill up before committing it
+    if (!this->stopping) {
+      lock.unlock();
+      std::this_thread::sleep_for(this->interval);
+      lock.lock();
+    }
+    batch.swap(this->pending);
+    lock.unlock();
+    this->commit(batch);
+    lock.lock();
+    for (Request *req : batch) req->done = true;
+    batch.clear();
+    this->finished.notify_all();
+  }
+}
+
+
+// Sync each file in the batch.  Each File is used by one thread, whose
+// request is the only one for it, so no file is synced twice; its
+// thread is blocked until the sync is done.
+void GroupCommit::commit(std::vector<Request *> &batch) {
+#if defined(SYNC_FILE_RANGE_WRITE)
+  // Start writeback on every file before waiting on any of them, so the
+  // device sees all of the group's writes together.  Files with a
+  // backend are left to the backend's sync: it may not be writing to
+  // the File's descriptor at all.
+  for (Request *req : batch) {
+    File *file = req->file;
+    if (file->backend == NULL && file->fd >= 0)
+      sync_file_range(file->fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+  }
+#endif
+
+  for (Request *req : batch)
+    req->result = req->file->syncData(this->dataOnly);
+}
@@ -0,0 +1,64 @@
+//
+// group_commit.h
+//
+// Batch durability requests from many Files and threads so that each
+// file is synced once per commit interval instead of once per record.
+//
+
+#if !defined(GROUP_COMMIT_H)
+#define GROUP_COMMIT_H
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class File;
+
+
+class GroupCommit {
+public:
+  // Requests arriving within interval of each other share one sync per
+  // file.  If dataOnly, use fdatasync rather than fsync.
+  explicit GroupCommit(std::chrono::microseconds interval =
+                         std::chrono::microseconds(1000),
+                       bool dataOnly = true);
+
+  // Finish any outstanding commits and stop the background thread.
+  ~GroupCommit();
+
+  // Flush file and block until its data is on stable storage.  Returns
+  // 0 on success, File::eof on failure, just as file.sync() (or
+  // datasync()) would: a File with a backend is synced by the backend,
+  // a File with no descriptor succeeds, and a failed sync puts the File
+  // in an error state.  Safe to call from several
+  // threads at once, as long as each File is used by one thread.
+  int sync(File &file);
+
+private:
+  struct Request {
+    File *file;
+    int result;
+    bool done;
+  };
+
+  std::chrono::microseconds interval;
+  bool dataOnly;
+  std::mutex mtx;
+  std::condition_variable work;
+  std::condition_variable finished;
+  std::vector<Request *> pending;
+  bool stopping = false;
+  std::thread worker;
+
+  void run();
+  void commit(std::vector<Request *> &batch);
+
+  // Disallow copy & assignment.
+  GroupCommit(GroupCommit const&) = delete;
+  GroupCommit& operator=(GroupCommit const&) = delete;
+};
+
+
+#endif
@@ -0,0 +1,89 @@
+//
+// memory_backend.cc
+//
+// A Backend that keeps the whole file in memory.
+//
+
+
+#include "memory_backend.h"
+
+#include <unistd.h>	// SEEK_*
+#include <string.h>	// memcpy
+#include <errno.h>
+
+
+MemoryBackend::MemoryBackend(const std::string &contents) : data(contents) {
+}
+
+
+const std::string &MemoryBackend::contents() {
+  return this->data;
+}
+
+
+ssize_t MemoryBackend::read(void *buf, size_t count) {
+  if (this->pos >= this->data.size()) return 0;
+  if (count > this->data.size() - this->pos)
+    count = this->data.size() - this->pos;
+  memcpy(buf, this->data.data() + this->pos, count);
+  this->pos += count;
+  return count;
+}
+
+
+ssize_t MemoryBackend::write(const void *buf, size_t count) {
+  struct iovec iov;
+  iov.iov_base = (void *)buf;
+  iov.iov_len = count;
+  return this->writev(&iov, 1);
+}
+
+
+ssize_t MemoryBackend::writev(const struct iovec *iov, int iovcnt) {
+  size_t total = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    size_t len = iov[i].iov_len;
+    if (len == 0) continue;
+    if (this->pos + len > this->data.size())
+      this->data.resize(this->pos + len);
+    memcpy(&this->data[this->pos], iov[i].iov_base, len);
+    this->pos += len;
+    total += len;
+  }
+  return total;
+}
+
+
+off_t MemoryBackend::seek(off_t offset, int whence) {
+  off_t size = this->data.size();
+  off_t base;
+  if (whence == SEEK_SET) {
+    base = 0;
+  } else if (whence == SEEK_CUR) {
+    base = this->pos;
+  } else if (whence == SEEK_END) {
+    base = size;
+  } else if (whence == SEEK_DATA || whence == SEEK_HOLE) {
+    if (offset < 0 || offset >= size) {
+      errno = (offset < 0) ? EINVAL : ENXIO;
+      return -1;
+    }
+    this->pos = (whence == SEEK_DATA) ? offset : size;
+    return this->pos;
+  } else {
+    errno = EINVAL;
+    return -1;
+  }
+  if (base + offset < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  this->pos = base + offset;
+  return this->pos;
+}
+
+
+// Nothing is stored outside memory.
+int MemoryBackend::sync(bool) {
+  return 0;
+}
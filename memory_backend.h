@@ -0,0 +1,47 @@
+//
+// memory_backend.h
+//
+// A Backend that keeps the whole file in memory: for building a File's
+// output as a string, parsing a string with File's readers, or running
+// File in tests without touching the disk.
+//
+//     MemoryBackend *mem = new MemoryBackend();
+//     File f(mem, "w+");
+//     f.fprintf("%d\n", 42);
+//     f.fflush();
+//     ... mem->contents() ...
+//
+// The File owns the backend, so the pointer is good only while the
+// File is open.
+//
+
+#if !defined(MEMORY_BACKEND_H)
+#define MEMORY_BACKEND_H
+
+#include "backend.h"
+
+#include <string>
+
+
+class MemoryBackend: public Backend {
+public:
+  explicit MemoryBackend(const std::string &contents = std::string());
+
+  // Everything written so far (flush the File first).
+  const std::string &contents();
+
+  ssize_t read(void *buf, size_t count);
+  ssize_t write(const void *buf, size_t count);
+  ssize_t writev(const struct iovec *iov, int iovcnt);
+  // Seeking past the end is allowed; a write there fills the gap with
+  // zeros.  The file has no holes, so seeking for data finds it at once.
+  off_t seek(off_t offset, int whence);
+  int sync(bool dataOnly);
+
+private:
+  std::string data;
+  size_t pos = 0;
+};
+
+
+#endif
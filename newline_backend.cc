@@ -0,0 +1,190 @@
+//
+// newline_backend.cc
+//
+// A Backend that reads CRLF as LF and writes LF as CRLF.
+//
+
+
+#include "newline_backend.h"
+
+#include <unistd.h>	// read, write, lseek
+#include <stdlib.h>	// malloc, free
+#include <string.h>	// memchr, memcpy, memmove
+#include <errno.h>
+
+
+// Drop the CR of each CRLF in p[0..len), moving the runs between CRs
+// down over the gaps.  Return the new length.
+static size_t compactCrlf(char *p, size_t len) {
+  const char *end = p + len;
+  char *w = (char *)memchr(p, '\r', len);
+  if (w == NULL) return len;
+  const char *r = w;
+  while (r < end) {
+    // r is at a CR
+    if (r + 1 < end && r[1] == '\n') r++;
+    const char *cr = (const char *)memchr(r + 1, '\r', end - r - 1);
+    if (cr == NULL) cr = end;
+    memmove(w, r, cr - r);
+    w += cr - r;
+    r = cr;
+  }
+  return w - p;
+}
+
+
+// Copy src[0..len) to out with each LF made CRLF.  out has room for
+// twice len.  Return the number of bytes stored.
+static size_t expandLf(const char *src, size_t len, char *out) {
+  const char *end = src + len;
+  char *o = out;
+  while (src < end) {
+    const char *lf = (const char *)memchr(src, '\n', end - src);
+    if (lf == NULL) lf = end;
+    memcpy(o, src, lf - src);
+    o += lf - src;
+    if (lf == end) break;
+    *o++ = '\r';
+    *o++ = '\n';
+    src = lf + 1;
+  }
+  return o - out;
+}
+
+
+NewlineBackend::NewlineBackend(int fd) : fd(fd) {
+  this->out = reinterpret_cast<char*>(malloc(out_size));
+}
+
+
+NewlineBackend::~NewlineBackend() {
+  this->flush();
+  free(this->out);
+}
+
+
+// Read and translate into p, which has room for at least 2 bytes.
+ssize_t NewlineBackend::readInto(char *p, size_t count) {
+  for (;;) {
+    size_t held = this->heldCR ? 1 : 0;
+    ssize_t n = ::read(this->fd, p + held, count - held);
+    if (n < 0) return -1;
+    if (held) p[0] = '\r';
+    this->heldCR = false;
+    if (n == 0) return held;	// A CR at the very end stands alone
+    size_t len = held + n;
+    if (p[len - 1] == '\r') {
+      this->heldCR = true;
+      len--;
+    }
+    len = compactCrlf(p, len);
+    if (len > 0) return len;
+  }
+}
+
+
+ssize_t NewlineBackend::read(void *buf, size_t count) {
+  if (this->lastAct == 'w') {
+    errno = EBADF;
+    return -1;
+  }
+  this->lastAct = 'r';
+  if (count == 0) return 0;
+  ssize_t n;
+  if (this->stageAt < this->stageEnd) {
+    ((char *)buf)[0] = this->stage[this->stageAt++];
+    n = 1;
+  } else if (count == 1) {
+    // Translate a little more than asked for and keep the rest
+    n = this->readInto(this->stage, sizeof(this->stage));
+    if (n <= 0) return n;
+    ((char *)buf)[0] = this->stage[0];
+    this->stageAt = 1;
+    this->stageEnd = n;
+    n = 1;
+  } else {
+    n = this->readInto((char *)buf, count);
+    if (n < 0) return -1;
+  }
+  this->pos += n;
+  return n;
+}
+
+
+// Write out the translated bytes held.
+int NewlineBackend::drain() {
+  while (this->outAt < this->outLen) {
+    ssize_t n = ::write(this->fd, this->out + this->outAt,
+                        this->outLen - this->outAt);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    this->outAt += n;
+  }
+  this->outAt = 0;
+  this->outLen = 0;
+  return 0;
+}
+
+
+ssize_t NewlineBackend::write(const void *buf, size_t count) {
+  if (this->lastAct == 'r') {
+    errno = EBADF;
+    return -1;
+  }
+  this->lastAct = 'w';
+  if (this->drain() != 0) return -1;
+  const char *src = (const char *)buf;
+  size_t done = 0;
+  while (done < count) {
+    size_t piece = out_size / 2;
+    if (piece > count - done) piece = count - done;
+    this->outLen = expandLf(src + done, piece, this->out);
+    done += piece;
+    if (this->drain() != 0) break;  // The rest stays held
+  }
+  this->pos += done;
+  return (done > 0) ? (ssize_t)done : -1;
+}
+
+
+ssize_t NewlineBackend::writev(const struct iovec *iov, int iovcnt) {
+  ssize_t total = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    if (iov[i].iov_len == 0) continue;
+    ssize_t n = this->write(iov[i].iov_base, iov[i].iov_len);
+    if (n < 0) return (total > 0) ? total : -1;
+    total += n;
+    if ((size_t)n < iov[i].iov_len) break;
+  }
+  return total;
+}
+
+
+off_t NewlineBackend::seek(off_t offset, int whence) {
+  if (offset == 0 && whence == SEEK_CUR) return this->pos;
+  if (offset != 0 || whence != SEEK_SET) {
+    errno = ESPIPE;
+    return -1;
+  }
+  if (this->flush() != 0 || lseek(this->fd, 0, SEEK_SET) == (off_t)-1)
+    return -1;
+  this->pos = 0;
+  this->lastAct = '0';
+  this->heldCR = false;
+  this->stageAt = 0;
+  this->stageEnd = 0;
+  return 0;
+}
+
+
+int NewlineBackend::flush() {
+  if (this->lastAct != 'w') return 0;
+  return this->drain();
+}
+
+
+int NewlineBackend::sync(bool dataOnly) {
+  return syncFd(this->fd, dataOnly);
+}
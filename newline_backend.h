@@ -0,0 +1,61 @@
+//
+// newline_backend.h
+//
+// A Backend for text files with Windows line ends: CRLF in the file is
+// read as LF, and LF is written as CRLF, so that fgets and friends see
+// one '\n' per line.  For text mode on a File open on a named file:
+//
+//     f.setBackend(new NewlineBackend(f.fileno()));
+//
+// Translation works a run at a time rather than a character at a time:
+// memchr finds the next CR (or LF, when writing) and the run before it
+// is moved in one memmove.  A CR at the end of a read is held back
+// until the next read shows whether an LF follows it.
+//
+
+#if !defined(NEWLINE_BACKEND_H)
+#define NEWLINE_BACKEND_H
+
+#include "backend.h"
+
+
+class NewlineBackend: public Backend {
+public:
+  // Translate the file open on fd, which stays owned by the caller.  Use
+  // the File for reading or for writing, not both.
+  explicit NewlineBackend(int fd);
+  ~NewlineBackend();
+
+  ssize_t read(void *buf, size_t count);
+  ssize_t write(const void *buf, size_t count);
+  ssize_t writev(const struct iovec *iov, int iovcnt);
+  // Only rewinding (seek(0, SEEK_SET)) and reporting the position in
+  // translated bytes (seek(0, SEEK_CUR)) are possible; otherwise ESPIPE.
+  off_t seek(off_t offset, int whence);
+  int flush();
+  int sync(bool dataOnly);
+
+private:
+  static const size_t out_size = 16384;
+
+  int fd;
+  off_t pos = 0;         // Translated bytes read or written
+  char lastAct = '0';    // 'r' or 'w' once used
+  bool heldCR = false;   // Read: a CR that may start a CRLF
+  char stage[2];         // Read: for one-byte reads
+  size_t stageAt = 0;
+  size_t stageEnd = 0;
+  char *out;             // Write: translated bytes not yet written
+  size_t outAt = 0;
+  size_t outLen = 0;
+
+  ssize_t readInto(char *p, size_t count);
+  int drain();
+
+  // Disallow copy & assignment.
+  NewlineBackend(NewlineBackend const&) = delete;
+  NewlineBackend& operator=(NewlineBackend const&) = delete;
+};
+
+
+#endif
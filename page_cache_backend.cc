@@ -0,0 +1,254 @@
+//
+// page_cache_backend.cc
+//
+// A Backend that keeps a set of fixed-size pages of the file in memory.
+//
+
+
+#include "page_cache_backend.h"
+
+#include <sys/stat.h>	// fstat
+#include <unistd.h>	// pread, lseek
+#include <limits.h>	// IOV_MAX
+#include <stdlib.h>	// malloc, free
+#include <string.h>	// memcpy, memset
+#include <errno.h>
+#include <algorithm>
+
+
+PageCacheBackend::PageCacheBackend(int fd, size_t pageSize, size_t pages)
+  : fd(fd), pageSize(pageSize > 0 ? pageSize : 16384),
+    slots(pages > 0 ? pages : 1) {
+  this->pages.reserve(this->slots.size());
+  struct stat st;
+  if (fstat(fd, &st) == 0) this->size = st.st_size;
+  off_t pos = lseek(fd, 0, SEEK_CUR);
+  if (pos > 0) this->pos = pos;
+}
+
+
+PageCacheBackend::~PageCacheBackend() {
+  this->flush();
+  lseek(this->fd, this->pos, SEEK_SET);
+  for (Page &page : this->slots) free(page.data);
+}
+
+
+// Find page index, bringing it into a slot if it isn't cached.  If
+// load is false the caller is about to overwrite the whole page, so
+// there's no need to read it.  Returns NULL, with errno set, if a dirty
+// page can't be written back to make room or the read fails.
+PageCacheBackend::Page *PageCacheBackend::get(off_t index, bool load) {
+  auto found = this->pages.find(index);
+  if (found != this->pages.end()) {
+    Page *page = &this->slots[found->second];
+    page->used = true;
+    return page;
+  }
+
+  Page *page = this->evict();
+  if (page == NULL) return NULL;
+  if (page->data == NULL) {
+    page->data = (char *)malloc(this->pageSize);
+    if (page->data == NULL) {
+      errno = ENOMEM;
+      return NULL;
+    }
+  }
+
+  // Past the end of the file there's nothing to read
+  off_t start = index * (off_t)this->pageSize;
+  size_t have = 0;
+  if (load && start < this->size) {
+    while (have < this->pageSize) {
+      ssize_t n = pread(this->fd, page->data + have, this->pageSize - have,
+                        start + have);
+      if (n < 0) {
+        if (errno == EINTR) continue;
+        return NULL;
+      }
+      if (n == 0) break;
+      have += n;
+    }
+  }
+  memset(page->data + have, 0, this->pageSize - have);
+
+  page->index = index;
+  page->used = true;
+  page->dirty = false;
+  this->pages[index] = page - &this->slots[0];
+  return page;
+}
+
+
+// Free a slot: the first one the clock hand finds that is empty or
+// hasn't been used since the hand last passed it.
+PageCacheBackend::Page *PageCacheBackend::evict() {
+  for (;;) {
+    size_t slot = this->hand;
+    Page *page = &this->slots[slot];
+    this->hand = (this->hand + 1) % this->slots.size();
+    if (page->index < 0) return page;
+    if (page->used) {
+      page->used = false;
+      continue;
+    }
+    if (page->dirty && this->writeBack(&slot, 1) != 0) return NULL;
+    this->pages.erase(page->index);
+    page->index = -1;
+    return page;
+  }
+}
+
+
+// Write the n dirty pages in run, whose page numbers are consecutive
+// and ascending, with as few pwritev calls as possible.
+int PageCacheBackend::writeBack(const size_t *run, size_t n) {
+  struct iovec iov[IOV_MAX];
+
+  for (size_t done = 0; done < n; ) {
+    int iovcnt = (int)std::min(n - done, (size_t)IOV_MAX);
+    off_t where = this->slots[run[done]].index * (off_t)this->pageSize;
+    for (int i = 0; i < iovcnt; i++) {
+      Page &page = this->slots[run[done + i]];
+      off_t start = page.index * (off_t)this->pageSize;
+      iov[i].iov_base = page.data;
+      iov[i].iov_len = std::min((off_t)this->pageSize, this->size - start);
+    }
+
+    int i = 0;
+    while (i < iovcnt) {
+      ssize_t w = pwritev(this->fd, iov + i, iovcnt - i, where);
+      if (w < 0) {
+        if (errno == EINTR) continue;
+        return -1;
+      }
+      where += w;
+      while (i < iovcnt && (size_t)w >= iov[i].iov_len) {
+        w -= iov[i].iov_len;
+        i++;
+      }
+      if (i < iovcnt) {
+        iov[i].iov_base = (char *)iov[i].iov_base + w;
+        iov[i].iov_len -= w;
+      }
+    }
+
+    for (i = 0; i < iovcnt; i++) this->slots[run[done + i]].dirty = false;
+    done += iovcnt;
+  }
+  return 0;
+}
+
+
+int PageCacheBackend::flush() {
+  std::vector<size_t> dirty;
+  for (size_t slot = 0; slot < this->slots.size(); slot++)
+    if (this->slots[slot].dirty) dirty.push_back(slot);
+  std::sort(dirty.begin(), dirty.end(), [this](size_t a, size_t b) {
+    return this->slots[a].index < this->slots[b].index;
+  });
+
+  // Split into runs of consecutive pages
+  size_t start = 0;
+  for (size_t i = 1; i <= dirty.size(); i++) {
+    if (i < dirty.size() &&
+        this->slots[dirty[i]].index == this->slots[dirty[i - 1]].index + 1)
+      continue;
+    if (this->writeBack(&dirty[start], i - start) != 0) return -1;
+    start = i;
+  }
+  return 0;
+}
+
+
+ssize_t PageCacheBackend::read(void *buf, size_t count) {
+  size_t done = 0;
+  while (done < count && this->pos < this->size) {
+    Page *page = this->get(this->pos / this->pageSize, true);
+    if (page == NULL) return done > 0 ? (ssize_t)done : -1;
+    size_t at = this->pos % this->pageSize;
+    size_t n = std::min(this->pageSize - at, count - done);
+    n = std::min(n, (size_t)(this->size - this->pos));
+    memcpy((char *)buf + done, page->data + at, n);
+    this->pos += n;
+    done += n;
+  }
+  return done;
+}
+
+
+ssize_t PageCacheBackend::write(const void *buf, size_t count) {
+  struct iovec iov;
+  iov.iov_base = (void *)buf;
+  iov.iov_len = count;
+  return this->writev(&iov, 1);
+}
+
+
+ssize_t PageCacheBackend::writev(const struct iovec *iov, int iovcnt) {
+  size_t total = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    const char *data = (const char *)iov[i].iov_base;
+    size_t len = iov[i].iov_len;
+    while (len > 0) {
+      size_t at = this->pos % this->pageSize;
+      size_t n = std::min(this->pageSize - at, len);
+      Page *page = this->get(this->pos / this->pageSize,
+                             n < this->pageSize);
+      if (page == NULL) return total > 0 ? (ssize_t)total : -1;
+      memcpy(page->data + at, data, n);
+      page->dirty = true;
+      this->pos += n;
+      if (this->pos > this->size) this->size = this->pos;
+      data += n;
+      len -= n;
+      total += n;
+    }
+  }
+  return total;
+}
+
+
+off_t PageCacheBackend::seek(off_t offset, int whence) {
+  off_t base;
+  if (whence == SEEK_SET) {
+    base = 0;
+  } else if (whence == SEEK_CUR) {
+    base = this->pos;
+  } else if (whence == SEEK_END) {
+    base = this->size;
+  } else if (whence == SEEK_DATA || whence == SEEK_HOLE) {
+    if (this->flush() != 0) return -1;
+    off_t pos = lseek(this->fd, offset, whence);
+    if (pos < 0) return -1;
+    this->pos = pos;
+    return pos;
+  } else {
+    errno = EINVAL;
+    return -1;
+  }
+  if (base + offset < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  this->pos = base + offset;
+  return this->pos;
+}
+
+
+int setPageCache(File &f, size_t pageSize, size_t pages) {
+  if (f.fileno() < 0 || pageSize == 0 || pages == 0) {
+    errno = EINVAL;
+    return File::eof;
+  }
+  // Dropping the old backend also hands an old cache's offset back to
+  // the descriptor
+  if (f.setBackend(NULL) != 0) return File::eof;
+  return f.setBackend(new PageCacheBackend(f.fileno(), pageSize, pages));
+}
+
+
+int PageCacheBackend::sync(bool dataOnly) {
+  return syncFd(this->fd, dataOnly);
+}
@@ -0,0 +1,85 @@
+//
+// page_cache_backend.h
+//
+// A Backend that keeps a set of fixed-size pages of the file in memory,
+// for "r+" Files doing random reads and updates.  A File's single
+// buffer is refilled on every seek outside it; here any recently used
+// page is served from memory, and an update only marks its page dirty.
+// setPageCache, below, installs it.
+//
+// Pages are found through a hash map on the page number.  When every
+// slot is full, a CLOCK sweep evicts a page that hasn't been used since
+// the hand last passed it, writing it back first if it is dirty.  flush
+// (and so File::fflush) writes all dirty pages in offset order, with
+// runs of consecutive pages going out in one pwritev.
+//
+// The File's own buffer still sits above the pages; for small records
+// scattered through the file, a File buffer of a record or two (see
+// File::setvbuf) saves copying a full buffer on each seek.
+//
+
+#if !defined(PAGE_CACHE_BACKEND_H)
+#define PAGE_CACHE_BACKEND_H
+
+#include "backend.h"
+#include "file.h"
+
+#include <stddef.h>
+#include <unordered_map>
+#include <vector>
+
+
+class PageCacheBackend: public Backend {
+public:
+  // Cache up to pages pages of pageSize bytes of the file open on fd,
+  // which stays owned by the caller.  Starts at fd's current offset, and
+  // leaves fd at the backend's offset when destroyed.
+  PageCacheBackend(int fd, size_t pageSize = 16384, size_t pages = 64);
+  ~PageCacheBackend();
+
+  ssize_t read(void *buf, size_t count);
+  ssize_t write(const void *buf, size_t count);
+  ssize_t writev(const struct iovec *iov, int iovcnt);
+  // Seeking past the end is allowed; a write there fills the gap with
+  // zeros.  seek_data and seek_hole flush, then ask the file.
+  off_t seek(off_t offset, int whence);
+  int flush();
+  int sync(bool dataOnly);
+
+private:
+  struct Page {
+    off_t index = -1;     // Page number, or -1 if the slot is free
+    char *data = NULL;
+    bool used = false;    // Touched since the clock hand last passed
+    bool dirty = false;
+  };
+
+  int fd;
+  size_t pageSize;
+  std::vector<Page> slots;
+  std::unordered_map<off_t, size_t> pages;  // Page number -> slot
+  size_t hand = 0;
+  off_t pos = 0;
+  off_t size = 0;       // Includes data not yet written back
+
+  Page *get(off_t index, bool load);
+  Page *evict();
+  int writeBack(const size_t *run, size_t n);
+
+  // Disallow copy & assignment.
+  PageCacheBackend(PageCacheBackend const&) = delete;
+  PageCacheBackend& operator=(PageCacheBackend const&) = delete;
+};
+
+
+// Page-cache mode for f, which must be open on a named file: keep up
+// to pages pages of pageSize bytes of the file in memory, writing dirty
+// pages back in offset order on fflush.  Replaces any backend f had
+// (including an earlier cache).  Use this rather than setBackend: the
+// cache starts from the descriptor's offset and size, so f has to be
+// flushed, and its read-ahead given back, before the cache is made.
+// f.setBackend(NULL) turns the cache off.
+int setPageCache(File &f, size_t pageSize = 16384, size_t pages = 64);
+
+
+#endif
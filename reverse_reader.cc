@@ -0,0 +1,99 @@
+//
+// reverse_reader.cc
+//
+// Read the lines of a File backwards, last line first.
+//
+
+
+#include "reverse_reader.h"
+#include "file.h"
+#include "scan.h"
+
+#include <stdlib.h>	// realloc, free
+#include <string.h>	// memmove
+
+
+ReverseReader::ReverseReader(File &file) : file(file) {
+}
+
+
+ReverseReader::~ReverseReader() {
+  free(this->win);
+}
+
+
+int ReverseReader::ferror() {
+  return this->err;
+}
+
+
+// Read the block before the window into the front of it.
+int ReverseReader::extend() {
+  if (this->winStart < 0) {
+    // First call: start at the end of the file
+    if (this->file.fseek(0, File::seek_end) != 0 ||
+        (this->cursor = this->file.ftell()) < 0) {
+      this->err = -1;
+      return -1;
+    }
+    this->winStart = this->cursor;
+  }
+  size_t keep = this->cursor - this->winStart;
+  size_t block = this->winStart < (long)block_size ? this->winStart
+                                                   : block_size;
+  if (keep + block > this->winCap) {
+    size_t cap = (keep + block) * 2;
+    char *grown = reinterpret_cast<char*>(realloc(this->win, cap));
+    if (grown == NULL) {
+      this->err = -1;
+      return -1;
+    }
+    this->win = grown;
+    this->winCap = cap;
+  }
+  memmove(this->win + block, this->win, keep);
+  long start = this->winStart - block;
+  if (this->file.fseek(start, File::seek_set) != 0 ||
+      this->file.fread(this->win, 1, block) != block) {
+    this->err = -2;
+    return -1;
+  }
+  this->winStart = start;
+  return 0;
+}
+
+
+bool ReverseReader::next(const char **line, size_t *len) {
+  if (this->done) return false;
+  if (this->winStart < 0) {
+    if (this->extend() != 0) return false;
+    if (this->cursor == 0) {
+      this->done = true;	// Empty file
+      return false;
+    }
+    // A newline at the very end terminates the last line; it doesn't
+    // start an empty one.
+    if (this->win[this->cursor - this->winStart - 1] == '\n')
+      this->cursor--;
+  }
+  size_t searched = 0;  // Bytes at the end of the window known to be clear
+  for (;;) {
+    size_t have = this->cursor - this->winStart;
+    const char *nl = findLast(this->win, have - searched, '\n');
+    if (nl != NULL) {
+      *line = nl + 1;
+      *len = this->win + have - *line;
+      this->cursor = this->winStart + (nl - this->win);
+      return true;
+    }
+    if (this->winStart == 0) {
+      // The first line of the file
+      *line = this->win;
+      *len = have;
+      this->done = true;
+      return true;
+    }
+    searched = have;
+    if (this->extend() != 0) return false;
+  }
+}
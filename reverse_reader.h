@@ -0,0 +1,56 @@
+//
+// reverse_reader.h
+//
+// Read the lines of a File backwards, last line first, e.g. to show the
+// tail of a large log without reading it from the start.
+//
+// The file is read in large blocks from the end towards the beginning
+// and each block is scanned for newlines with findLast.  Lines are
+// returned as views into the reader's window, without copying; a view
+// is valid until the next call to next().
+//
+
+#if !defined(REVERSE_READER_H)
+#define REVERSE_READER_H
+
+#include <cstddef>
+
+class File;
+
+
+class ReverseReader {
+public:
+  // Bytes read per step back through the file.  Larger than File's
+  // default buffer, so blocks are read straight into the window.
+  static const size_t block_size = 65536;
+
+  // Read file, which must be readable and seekable, from its end.  The
+  // file's position is changed by reading.
+  explicit ReverseReader(File &file);
+  ~ReverseReader();
+
+  // Set *line and *len to the next line (without its newline), working
+  // backwards.  Return false when there are no more lines, or on error
+  // (see ferror()).
+  bool next(const char **line, size_t *len);
+
+  int ferror();
+
+private:
+  File &file;
+  char *win = NULL;      // Unconsumed data: file offsets [winStart, cursor)
+  size_t winCap = 0;
+  long winStart = -1;    // -1 until the first block is read
+  long cursor = 0;
+  bool done = false;
+  int err = 0;
+
+  int extend();
+
+  // Disallow copy & assignment.
+  ReverseReader(ReverseReader const&) = delete;
+  ReverseReader& operator=(ReverseReader const&) = delete;
+};
+
+
+#endif
@@ -0,0 +1,145 @@
+//
+// rotating_backend.cc
+//
+// A write-only Backend for log files that rolls over to a new file
+// when the current one reaches a size or age limit, without making
+// writers wait.
+//
+
+
+#include "rotating_backend.h"
+
+#include <fcntl.h>	// open
+#include <sys/stat.h>	// fstat
+#include <unistd.h>	// write, close, dup
+#include <stdio.h>	// rename
+#include <errno.h>
+
+
+RotatingBackend::RotatingBackend(int fd, const char *base, size_t maxBytes,
+                                 std::chrono::seconds maxAge, int keep,
+                                 std::function<void(const std::string &)>
+                                   onRotate)
+  : base(base), maxBytes(maxBytes), maxAge(maxAge), keep(keep),
+    onRotate(onRotate), nextFd(-1) {
+  this->fd = dup(fd);
+  struct stat st;
+  this->written = (fstat(this->fd, &st) == 0) ? st.st_size : 0;
+  this->started = std::chrono::steady_clock::now();
+  this->worker = std::thread(&RotatingBackend::run, this);
+}
+
+
+RotatingBackend::~RotatingBackend() {
+  {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    this->stopping = true;
+  }
+  this->work.notify_one();
+  this->worker.join();
+  close(this->fd);
+}
+
+
+std::string RotatingBackend::segment(int n) {
+  return this->base + "." + std::to_string(n);
+}
+
+
+ssize_t RotatingBackend::read(void *, size_t) {
+  errno = EBADF;
+  return -1;
+}
+
+
+off_t RotatingBackend::seek(off_t, int) {
+  errno = ESPIPE;
+  return -1;
+}
+
+
+ssize_t RotatingBackend::write(const void *buf, size_t count) {
+  if (this->due()) this->rotate();
+  ssize_t n = ::write(this->fd, buf, count);
+  if (n > 0) this->written += n;
+  return n;
+}
+
+
+int RotatingBackend::sync(bool dataOnly) {
+  return syncFd(this->fd, dataOnly);
+}
+
+
+bool RotatingBackend::due() {
+  if (this->maxBytes > 0 && this->written >= this->maxBytes) return true;
+  return this->maxAge.count() > 0 &&
+         std::chrono::steady_clock::now() - this->started >= this->maxAge;
+}
+
+
+// Switch to the segment the background thread opened ahead of time.
+// If it isn't ready, carry on with the current one and try again on the
+// next write.
+void RotatingBackend::rotate() {
+  int next = this->nextFd.exchange(-1);
+  if (next < 0) return;
+  int old = this->fd;
+  this->fd = next;
+  this->written = 0;
+  this->started = std::chrono::steady_clock::now();
+  {
+    std::lock_guard<std::mutex> lock(this->mtx);
+    this->retired.push_back(old);
+  }
+  this->work.notify_one();
+}
+
+
+void RotatingBackend::run() {
+  std::string pending = this->base + ".next";
+  std::unique_lock<std::mutex> lock(this->mtx);
+  for (;;) {
+    while (!this->retired.empty()) {
+      int old = this->retired.front();
+      this->retired.erase(this->retired.begin());
+      lock.unlock();
+      this->retire(old);
+      lock.lock();
+    }
+    if (this->stopping) break;
+    if (this->nextFd.load() < 0) {
+      lock.unlock();
+      int fd = open(pending.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+      lock.lock();
+      if (fd >= 0) {
+        this->nextFd.store(fd);
+      } else if (!this->stopping && this->retired.empty()) {
+        // Try again a little later rather than spinning
+        this->work.wait_for(lock, std::chrono::seconds(1));
+        continue;
+      }
+    }
+    this->work.wait(lock, [this] {
+      return this->stopping || !this->retired.empty();
+    });
+  }
+  int unused = this->nextFd.exchange(-1);
+  if (unused >= 0) {
+    close(unused);
+    unlink(pending.c_str());
+  }
+}
+
+
+// Close a finished segment, shift the older ones down, and move the
+// segment the writer is now using into the live name.
+void RotatingBackend::retire(int old) {
+  close(old);
+  unlink(this->segment(this->keep).c_str());
+  for (int i = this->keep - 1; i >= 1; i--)
+    rename(this->segment(i).c_str(), this->segment(i + 1).c_str());
+  if (this->keep > 0) rename(this->base.c_str(), this->segment(1).c_str());
+  rename((this->base + ".next").c_str(), this->base.c_str());
+  if (this->onRotate && this->keep > 0) this->onRotate(this->segment(1));
+}
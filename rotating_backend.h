@@ -0,0 +1,84 @@
+//
+// rotating_backend.h
+//
+// A write-only Backend for log files that rolls over to a new file
+// when the current one reaches a size or age limit.  With a base name
+// of "app.log", the live file is always "app.log" and older segments
+// are "app.log.1" (newest) through "app.log.<keep>" (oldest).
+//
+// Writers never wait on the rollover: a background thread opens the
+// next segment ahead of time, so switching is just swapping
+// descriptors.  The same thread closes and renames the finished
+// segment and, if asked, hands it to a callback (e.g. to compress it).
+// If the next segment isn't ready yet, writing simply continues in the
+// current one.
+//
+
+#if !defined(ROTATING_BACKEND_H)
+#define ROTATING_BACKEND_H
+
+#include "backend.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+class RotatingBackend: public Backend {
+public:
+  // fd is the File's descriptor for base; the backend writes through
+  // its own duplicate.  A zero maxBytes or maxAge disables that limit.
+  // onRotate, if given, is called on the background thread with the
+  // path of each finished segment after it has been renamed.
+  RotatingBackend(int fd, const char *base, size_t maxBytes,
+                  std::chrono::seconds maxAge = std::chrono::seconds(0),
+                  int keep = 5,
+                  std::function<void(const std::string &)> onRotate = nullptr);
+  ~RotatingBackend();
+
+  // Reading and seeking fail with EBADF and ESPIPE respectively.
+  ssize_t read(void *buf, size_t count);
+  ssize_t write(const void *buf, size_t count);
+  off_t seek(off_t offset, int whence);
+  // Syncs the segment being written.  After a rollover, that is no
+  // longer the File's own descriptor, which is left on the first one.
+  int sync(bool dataOnly);
+
+private:
+  std::string base;
+  size_t maxBytes;
+  std::chrono::seconds maxAge;
+  int keep;
+  std::function<void(const std::string &)> onRotate;
+
+  // Used only by the writing thread
+  int fd;
+  size_t written;
+  std::chrono::steady_clock::time_point started;
+
+  // Shared with the background thread
+  std::atomic<int> nextFd;
+  std::mutex mtx;
+  std::condition_variable work;
+  std::vector<int> retired;
+  bool stopping = false;
+  std::thread worker;
+
+  bool due();
+  void rotate();
+  void run();
+  void retire(int old);
+  std::string segment(int n);
+
+  // Disallow copy & assignment.
+  RotatingBackend(RotatingBackend const&) = delete;
+  RotatingBackend& operator=(RotatingBackend const&) = delete;
+};
+
+
+#endif
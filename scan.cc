@@ -0,0 +1,32 @@
+//
+// scan.cc
+//
+// Byte-scanning kernels shared by File and its readers, vectorized
+// with SSE2 where available.
+//
+
+
+#include "scan.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+
+// Scans backwards 16 bytes at a time.
+const char *findLast(const char *p, size_t n, char c) {
+#if defined(__SSE2__)
+  const __m128i want = _mm_set1_epi8(c);
+  while (n >= 16) {
+    n -= 16;
+    __m128i v = _mm_loadu_si128((const __m128i *)(p + n));
+    int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, want));
+    if (mask != 0)
+      return p + n + (31 - __builtin_clz(mask)); // highest matching byte
+  }
+#endif
+  while (n > 0) {
+    if (p[--n] == c) return p + n;
+  }
+  return NULL;
+}
@@ -0,0 +1,19 @@
+//
+// scan.h
+//
+// Byte-scanning kernels shared by File and its readers, vectorized
+// with SSE2 where available.
+//
+
+#if !defined(SCAN_H)
+#define SCAN_H
+
+#include <cstddef>
+
+
+// Return a pointer to the last c in p[0..n), or NULL if there is none
+// (memrchr).
+const char *findLast(const char *p, size_t n, char c);
+
+
+#endif
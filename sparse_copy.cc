@@ -0,0 +1,67 @@
+//
+// sparse_copy.cc
+//
+// Copy a file without reading or writing its holes.
+//
+
+
+#include "sparse_copy.h"
+
+#include <errno.h>
+
+
+static const size_t CHUNK = 64 * 1024;
+
+
+// Copy len bytes at offset from src to the same offset in dst.
+static int copyRange(File &src, File &dst, off_t offset, off_t len) {
+  char chunk[CHUNK];
+  if (src.fseek(offset, File::seek_set) != 0 ||
+      dst.fseek(offset, File::seek_set) != 0)
+    return -1;
+  while (len > 0) {
+    size_t want = (len < (off_t)CHUNK) ? (size_t)len : CHUNK;
+    size_t n = src.fread(chunk, 1, want);
+    if (n == 0) return src.ferror() ? -1 : 0;  // src got shorter
+    if (dst.fwrite(chunk, 1, n) != n) return -1;
+    len -= n;
+  }
+  return 0;
+}
+
+
+off_t sparseCopy(File &src, File &dst) {
+  if (src.fseek(0, File::seek_end) != 0) return -1;
+  off_t size = src.ftell();
+  if (size < 0) return -1;
+
+  off_t copied = 0;
+  off_t at = 0;
+  while (at < size) {
+    off_t data, hole;
+    if (src.fseek(at, File::seek_data) == 0) {
+      data = src.ftell();
+      hole = (src.fseek(data, File::seek_hole) == 0) ? src.ftell() : size;
+    } else if (errno == ENXIO) {
+      break;			// Only a hole is left
+    } else if (errno == EINVAL || errno == EOPNOTSUPP) {
+      data = at;		// No hole information: copy the rest
+      hole = size;
+    } else {
+      return -1;
+    }
+    if (data < 0 || hole < 0) return -1;
+    if (hole > size) hole = size;
+    if (copyRange(src, dst, data, hole - data) != 0) return -1;
+    copied += hole - data;
+    at = hole;
+  }
+
+  // A trailing hole still has to extend dst to the full size
+  if (at < size) {
+    if (dst.fseek(size - 1, File::seek_set) != 0 || dst.fputc(0) == File::eof)
+      return -1;
+  }
+  if (dst.fflush() != 0) return -1;
+  return copied;
+}
@@ -0,0 +1,22 @@
+//
+// sparse_copy.h
+//
+// Copy a file without reading or writing its holes.
+//
+
+#if !defined(SPARSE_COPY_H)
+#define SPARSE_COPY_H
+
+#include "file.h"
+
+#include <sys/types.h>
+
+
+// Copy all of src into dst, which should be empty, leaving the holes in
+// src as holes in dst: only the data extents found with seek_data and
+// seek_hole are read and written.  If src can't report its holes, it is
+// copied whole.  Return the number of data bytes copied, or -1.
+off_t sparseCopy(File &src, File &dst);
+
+
+#endif
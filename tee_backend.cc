@@ -0,0 +1,130 @@
+//
+// tee_backend.cc
+//
+// A write-only Backend that copies everything written to a File to
+// several file descriptors.
+//
+
+
+#include "tee_backend.h"
+
+#include <unistd.h>
+#include <errno.h>
+
+// Largest number of pieces passed in one writev.
+static const int MAX_IOV = 16;
+
+
+// Write all of iov to fd, resuming after short writes.  Returns 0 or an
+// errno value.
+static int writevAll(int fd, const struct iovec *iov, int iovcnt) {
+  struct iovec local[MAX_IOV];
+  int n = 0;
+  for (int i = 0; i < iovcnt && n < MAX_IOV; i++) {
+    if (iov[i].iov_len > 0) local[n++] = iov[i];
+  }
+  struct iovec *at = local;
+  while (n > 0) {
+    ssize_t w = ::writev(fd, at, n);
+    if (w < 0) {
+      if (errno == EINTR) continue;
+      return errno;
+    }
+    while (n > 0 && (size_t)w >= at->iov_len) {
+      w -= at->iov_len;
+      at++;
+      n--;
+    }
+    if (n > 0) {
+      at->iov_base = (char *)at->iov_base + w;
+      at->iov_len -= w;
+    }
+  }
+  return 0;
+}
+
+
+TeeBackend::TeeBackend(int fd) {
+  this->addSink(fd);
+}
+
+
+size_t TeeBackend::addSink(int fd) {
+  Sink sink = {fd, 0};
+  this->sinks.push_back(sink);
+  return this->sinks.size() - 1;
+}
+
+
+int TeeBackend::sinkError(size_t i) {
+  return i < this->sinks.size() ? this->sinks[i].err : EINVAL;
+}
+
+
+ssize_t TeeBackend::read(void *, size_t) {
+  errno = EBADF;
+  return -1;
+}
+
+
+off_t TeeBackend::seek(off_t, int) {
+  errno = ESPIPE;
+  return -1;
+}
+
+
+ssize_t TeeBackend::write(const void *buf, size_t count) {
+  struct iovec iov;
+  iov.iov_base = (void *)buf;
+  iov.iov_len = count;
+  return this->writev(&iov, 1);
+}
+
+
+ssize_t TeeBackend::writev(const struct iovec *iov, int iovcnt) {
+  if (iovcnt > MAX_IOV) iovcnt = MAX_IOV;
+  size_t total = 0;
+  for (int i = 0; i < iovcnt; i++) total += iov[i].iov_len;
+
+  int lastErr = EBADF;		// Reported if there are no healthy sinks
+  bool written = false;
+  for (size_t i = 0; i < this->sinks.size(); i++) {
+    Sink &sink = this->sinks[i];
+    if (sink.err != 0) {
+      lastErr = sink.err;
+      continue;
+    }
+    sink.err = writevAll(sink.fd, iov, iovcnt);
+    if (sink.err == 0) written = true;
+    else lastErr = sink.err;
+  }
+  if (!written) {
+    errno = lastErr;
+    return -1;
+  }
+  return total;
+}
+
+
+int TeeBackend::sync(bool dataOnly) {
+  int lastErr = EBADF;		// Reported if there are no healthy sinks
+  bool synced = false;
+  for (size_t i = 0; i < this->sinks.size(); i++) {
+    Sink &sink = this->sinks[i];
+    if (sink.err != 0) {
+      lastErr = sink.err;
+      continue;
+    }
+    if (syncFd(sink.fd, dataOnly) == 0) {
+      synced = true;
+    } else {
+      sink.err = errno;
+      lastErr = sink.err;
+    }
+  }
+  if (!synced) {
+    errno = lastErr;
+    return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,51 @@
+//
+// tee_backend.h
+//
+// A write-only Backend that copies everything written to a File to
+// several file descriptors.  The File formats and buffers the data
+// once; each flush becomes one writev per sink.
+//
+// Sinks fail independently: a sink that reports an error, writing or
+// syncing, is dropped and its errno kept for sinkError(), while the
+// others carry on.  Writes and syncs fail only when every sink has
+// failed.
+//
+
+#if !defined(TEE_BACKEND_H)
+#define TEE_BACKEND_H
+
+#include "backend.h"
+
+#include <vector>
+
+
+class TeeBackend: public Backend {
+public:
+  // Start with fd (usually the File's own fileno()) as the first sink.
+  // None of the descriptors are closed by the backend.
+  explicit TeeBackend(int fd);
+
+  // Add another sink; returns its index for sinkError.
+  size_t addSink(int fd);
+
+  // 0 if sink i is healthy, otherwise the errno that disabled it.
+  int sinkError(size_t i);
+
+  // Reading and seeking fail with EBADF and ESPIPE respectively.
+  ssize_t read(void *buf, size_t count);
+  ssize_t write(const void *buf, size_t count);
+  ssize_t writev(const struct iovec *iov, int iovcnt);
+  off_t seek(off_t offset, int whence);
+  // Sync every healthy sink.
+  int sync(bool dataOnly);
+
+private:
+  struct Sink {
+    int fd;
+    int err;
+  };
+  std::vector<Sink> sinks;
+};
+
+
+#endif
@@ -0,0 +1,108 @@
+//
+// async_file_test.cc
+//
+// AsyncIo as a single-threaded executor: thousands of coroutines, each
+// with its own File, all in flight at once.  Each writes numbered
+// lines with async_write (and some with plain fwrite, since the buffer
+// is shared), flushes, rewinds and reads them back with async_getline
+// and async_read.  Every coroutine must resume on the thread running
+// AsyncIo::run.  Needs C++20; built and run by "make test".
+//
+
+
+#include "async_file.h"
+#include "file.h"
+#include "test_util.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+static const int lines = 50;
+
+// Shared by the coroutines; only the run() thread touches them.
+static std::thread::id runner;
+static int inFlight = 0;
+static int mostInFlight = 0;
+static int wrongThread = 0;
+static int bad = 0;
+
+
+static void onRunner() {
+  if (std::this_thread::get_id() != runner) wrongThread++;
+}
+
+
+static Task roundTrip(AsyncIo &io, std::string name, int id) {
+  inFlight++;
+  if (inFlight > mostInFlight) mostInFlight = inFlight;
+  onRunner();
+  {
+    File f(name.c_str(), "r+");
+    f.setvbuf(NULL, File::FULL_BUFFER, 256);	// Make the pool do work
+    char line[64];
+    std::string want;
+    for (int i = 0; i < lines; i++) {
+      int n = snprintf(line, sizeof(line), "file %d line %d\n", id, i);
+      want.append(line, n);
+      if (i % 5 == 0) {
+        if (f.fwrite(line, 1, n) != (size_t)n) bad++;
+      } else {
+        if (co_await io.async_write(f, line, n) != (size_t)n) bad++;
+        onRunner();
+      }
+    }
+    if (co_await io.async_flush(f) != 0) bad++;
+    onRunner();
+
+    f.fseek(0, File::seek_set);
+    std::string got;
+    for (int i = 0; i < lines / 2; i++) {
+      if (co_await io.async_getline(f, line, sizeof(line)) == NULL) break;
+      onRunner();
+      got += line;
+    }
+    for (;;) {
+      size_t n = co_await io.async_read(f, line, sizeof(line));
+      onRunner();
+      if (n == 0 || n == (size_t)File::eof) break;
+      got.append(line, n);
+    }
+    if (got != want) bad++;
+  }
+  unlink(name.c_str());
+  inFlight--;
+}
+
+
+int main() {
+  // One descriptor per File, all open at once
+  struct rlimit rl;
+  getrlimit(RLIMIT_NOFILE, &rl);
+  rl.rlim_cur = rl.rlim_max;
+  setrlimit(RLIMIT_NOFILE, &rl);
+  int files = 4000;
+  if (rl.rlim_cur < (rlim_t)files + 64) files = (int)rl.rlim_cur - 64;
+
+  runner = std::this_thread::get_id();
+  AsyncIo io;
+  for (int i = 0; i < files; i++) {
+    char name[] = "/tmp/async_file_testXXXXXX";
+    scratchFile(name);
+    io.spawn(roundTrip(io, name, i));
+  }
+  io.run();
+
+  printf("%d files, %d in flight at once\n", files, mostInFlight);
+  check(mostInFlight == files, "every coroutine in flight at once");
+  check(inFlight == 0, "every coroutine finished");
+  check(wrongThread == 0, "coroutines resumed only on the run() thread");
+  check(bad == 0, "every file written and read back");
+
+  return finish("async_file_test", NULL);
+}
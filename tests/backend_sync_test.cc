@@ -0,0 +1,144 @@
+//
+// backend_sync_test.cc
+//
+// File::sync, File::datasync and GroupCommit on Files with a backend:
+// each goes through Backend::sync, so a rotated log syncs its live
+// segment, a tee syncs every sink, and a backend that can't sync
+// reports failure rather than success.  Built and run by "make test".
+//
+
+
+#include "file.h"
+#include "group_commit.h"
+#include "rotating_backend.h"
+#include "tee_backend.h"
+#include "test_util.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+#include <string>
+#include <thread>
+
+
+// Writes go nowhere; syncs are counted, and fail if asked to.
+class CountingBackend: public Backend {
+public:
+  int syncs = 0;
+  int dataSyncs = 0;
+  bool fail = false;
+
+  ssize_t read(void *, size_t) { return 0; }
+  ssize_t write(const void *, size_t count) { return count; }
+  off_t seek(off_t, int) { return 0; }
+  int sync(bool dataOnly) {
+    (dataOnly ? this->dataSyncs : this->syncs)++;
+    if (this->fail) {
+      errno = EIO;
+      return -1;
+    }
+    return 0;
+  }
+};
+
+
+// A backend that doesn't say how to sync.
+class NoSyncBackend: public Backend {
+public:
+  ssize_t read(void *, size_t) { return 0; }
+  ssize_t write(const void *, size_t count) { return count; }
+  off_t seek(off_t, int) { return 0; }
+};
+
+
+static char name[] = "/tmp/backend_sync_testXXXXXX";
+
+
+int main() {
+  GroupCommit gc(std::chrono::microseconds(0), false);
+  GroupCommit gcData(std::chrono::microseconds(0), true);
+  scratchFile(name);
+
+  // Every path reaches the backend, with the right kind of sync
+  {
+    CountingBackend *counting = new CountingBackend();
+    File f(counting, "w");
+    f.fputs("x");
+    check(f.sync() == 0 && counting->syncs == 1, "File::sync");
+    check(f.datasync() == 0 && counting->dataSyncs == 1, "File::datasync");
+    check(gc.sync(f) == 0 && counting->syncs == 2, "GroupCommit");
+    check(gcData.sync(f) == 0 && counting->dataSyncs == 2,
+          "GroupCommit, data only");
+    counting->fail = true;
+    check(f.sync() == File::eof && f.ferror() != 0, "backend sync fails");
+  }
+  {
+    CountingBackend *counting = new CountingBackend();
+    counting->fail = true;
+    File f(counting, "w");
+    f.fputs("x");
+    check(gcData.sync(f) == File::eof && f.ferror() != 0,
+          "backend sync fails in GroupCommit");
+  }
+
+  // No sync of its own: never reported durable
+  {
+    File f(new NoSyncBackend(), "w");
+    f.fputs("x");
+    errno = 0;
+    check(f.sync() == File::eof && errno == EOPNOTSUPP,
+          "no sync means EOPNOTSUPP");
+  }
+
+  // A rotated log: after a rollover the live segment is no longer the
+  // File's descriptor, and it is what gets synced
+  {
+    File f(name, "w");
+    f.setBackend(new RotatingBackend(f.fileno(), name, 16));
+    std::string first = std::string(name) + ".1";
+    for (int i = 0; i < 1000 && access(first.c_str(), F_OK) != 0; i++) {
+      f.fputs("a record past the limit\n");
+      f.fflush();
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    check(access(first.c_str(), F_OK) == 0, "log rolled over");
+    f.fputs("after the rollover\n");
+    check(f.sync() == 0, "File::sync after a rollover");
+    f.fputs("and again\n");
+    check(gcData.sync(f) == 0, "GroupCommit after a rollover");
+    for (int i = 1; i <= 5; i++)
+      unlink((std::string(name) + "." + std::to_string(i)).c_str());
+  }
+
+  // A tee syncs every healthy sink; one that can't sync (a pipe) is
+  // dropped, and the sync fails only once no sink is left
+  int p[2];
+  check(pipe(p) == 0, "pipe");
+  spit(name, "");
+  {
+    File f(name, "w");
+    TeeBackend *tee = new TeeBackend(f.fileno());
+    size_t piped = tee->addSink(p[1]);
+    f.setBackend(tee);
+    f.fputs("teed\n");
+    check(f.sync() == 0, "tee sync with one good sink");
+    check(tee->sinkError(0) == 0, "file sink still healthy");
+    check(tee->sinkError(piped) == EINVAL, "pipe sink dropped");
+  }
+  check(slurp(name) == "teed\n", "teed data written");
+  char path[32];
+  snprintf(path, sizeof(path), "/proc/self/fd/%d", p[1]);
+  {
+    File f(path, "w");
+    f.setBackend(new TeeBackend(f.fileno()));
+    f.fputs("teed\n");
+    check(gc.sync(f) == File::eof && f.ferror() != 0,
+          "tee sync with no good sink fails");
+  }
+  close(p[0]);
+  close(p[1]);
+
+  return finish("backend_sync_test", name);
+}
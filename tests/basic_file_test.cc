@@ -0,0 +1,159 @@
+//
+// basic_file_test.cc
+//
+// BasicFile under failing writes, through a storage policy that puts a
+// FaultBackend in front of a named file: what fwrite and fflush report
+// as written must be exactly what ends up in the file, with nothing
+// lost or written twice.  Built and run by "make test".
+//
+
+
+#include "basic_file.h"
+#include "fault_backend.h"
+#include "test_util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+
+
+static char name[] = "/tmp/basic_file_testXXXXXX";
+
+
+// A named file with faults injected into its reads, writes and seeks.
+class FaultStorage {
+public:
+  FaultStorage(int flags, const char *name)
+    : file(flags, name), faults(file.fileno()) {
+  }
+
+  FaultBackend &backend() {
+    return this->faults;
+  }
+
+  ssize_t read(void *buf, size_t count) {
+    return this->faults.read(buf, count);
+  }
+  ssize_t writev(const struct iovec *iov, int iovcnt) {
+    return this->faults.writev(iov, iovcnt);
+  }
+  off_t seek(off_t offset, int whence) {
+    return this->faults.seek(offset, whence);
+  }
+
+private:
+  FdStorage file;
+  FaultBackend faults;
+};
+
+typedef BasicFile<WriteAccess, Buffered, FaultStorage> FaultyFile;
+typedef BasicFile<WriteAccess, Unbuffered, FaultStorage> UnbufferedFaultyFile;
+
+
+static std::string text(size_t n) {
+  std::string s(n, 0);
+  for (size_t i = 0; i < n; i++) s[i] = 'a' + rand() % 26;
+  return s;
+}
+
+
+// Sequential writes that may fail; nothing may be lost or repeated.
+template <class F>
+static bool failingWrites(int seed) {
+  srand(seed);
+  spit(name, "");
+  std::string model;
+  bool ok;
+  {
+    F f(name);
+    f.storage().backend().randomize(seed, 4, FaultBackend::short_io |
+                                             FaultBackend::no_space |
+                                             FaultBackend::io_error);
+    for (int it = 0; it < 2000; it++) {
+      std::string d = text((rand() % 5 == 0) ? rand() % 20000
+                                             : rand() % 200);
+      size_t n = f.fwrite(d.data(), 1, d.size());
+      if (n == (size_t)File::eof) continue;	// None of it was taken
+      if (n > d.size()) return false;
+      model.append(d, 0, n);
+      if (rand() % 50 == 0) f.fflush();	// May fail; keeps the rest
+    }
+    f.storage().backend().randomize(0, 0, 0);
+    ok = f.fflush() == 0;
+  }
+  return ok && slurp(name) == model;
+}
+
+
+int main(int argc, char **argv) {
+  int seeds = (argc > 1) ? atoi(argv[1]) : 40;
+  scratchFile(name);
+
+  // Buffered: a flush that writes half the buffer, then hits ENOSPC,
+  // keeps the other half for the next flush
+  {
+    FaultyFile f(name);
+    f.storage().backend().inject(FaultBackend::WRITE, 0,
+                                 FaultBackend::short_io);
+    f.storage().backend().inject(FaultBackend::WRITE, 1,
+                                 FaultBackend::no_space);
+    check(f.fwrite("0123456789", 1, 10) == 10, "buffered write");
+    check(f.fflush() == File::eof && f.ferror() != 0, "flush fails");
+    check(slurp(name) == "01234", "first half written");
+    check(f.fflush() == 0, "flush once the disk has room");
+  }
+  check(slurp(name) == "0123456789", "nothing written twice");
+
+  // Unbuffered: fwrite reports the half that went out
+  spit(name, "");
+  {
+    UnbufferedFaultyFile f(name);
+    f.storage().backend().inject(FaultBackend::WRITE, 0,
+                                 FaultBackend::short_io);
+    f.storage().backend().inject(FaultBackend::WRITE, 1,
+                                 FaultBackend::no_space);
+    check(f.fwrite("0123456789", 1, 10) == 5, "unbuffered write is short");
+  }
+  check(slurp(name) == "01234", "unbuffered short write");
+
+  // Buffered, a write too big to buffer going out with the buffer.
+  // Half of the buffer gets out before ENOSPC: none of the new data was
+  // written, and the rest of the buffer stays for the next flush
+  std::string big(20000, 'b');
+  spit(name, "");
+  {
+    FaultyFile f(name);
+    f.storage().backend().inject(FaultBackend::WRITE, 0,
+                                 FaultBackend::short_io);
+    f.storage().backend().inject(FaultBackend::WRITE, 1,
+                                 FaultBackend::no_space);
+    check(f.fwrite("0123456789", 1, 10) == 10, "small write");
+    check(f.fwrite(big.data(), 1, big.size()) == (size_t)File::eof,
+          "big write after part of the buffer");
+    check(f.fflush() == 0, "rest of the buffer flushed");
+  }
+  check(slurp(name) == "0123456789", "buffer written once, big not at all");
+
+  // The same with nothing buffered: half the big write gets out
+  spit(name, "");
+  {
+    FaultyFile f(name);
+    f.storage().backend().inject(FaultBackend::WRITE, 0,
+                                 FaultBackend::short_io);
+    f.storage().backend().inject(FaultBackend::WRITE, 1,
+                                 FaultBackend::no_space);
+    check(f.fwrite(big.data(), 1, big.size()) == 10000,
+          "big write reports what went out");
+  }
+  check(slurp(name) == big.substr(0, 10000), "partial big write");
+
+  int bad = 0;
+  for (int seed = 1; seed <= seeds; seed++) {
+    if (!failingWrites<FaultyFile>(seed)) bad++;
+    if (!failingWrites<UnbufferedFaultyFile>(seed)) bad++;
+  }
+  if (bad > 0) printf("%d runs lost or repeated data\n", bad);
+  check(bad == 0, "random failing writes");
+
+  return finish("basic_file_test", name);
+}
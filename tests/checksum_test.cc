@@ -0,0 +1,72 @@
+//
+// checksum_test.cc
+//
+// Check Checksum against the reference values in
+// tests/data/checksum_vectors.txt, fed whole and in random pieces.
+// Built and run (from the top of the tree) by "make test".
+//
+
+
+#include "checksum.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+
+static const char *vectors = "tests/data/checksum_vectors.txt";
+
+
+int main(int argc, char **argv) {
+  if (argc > 1) vectors = argv[1];
+  FILE *in = fopen(vectors, "r");
+  if (in == NULL) {
+    perror(vectors);
+    return 1;
+  }
+
+  if (Checksum::crc32c(0, "123456789", 9) != 0xe3069283) {
+    printf("crc32c check value wrong\n");
+    return 1;
+  }
+
+  int failed = 0, checked = 0;
+  char line[256];
+  srand(1);
+  while (fgets(line, sizeof(line), in) != NULL) {
+    if (line[0] == '#') continue;
+    char kind[16];
+    unsigned long long seed, want;
+    size_t len;
+    if (sscanf(line, "%15s %llu %zu %llx", kind, &seed, &len, &want) != 4)
+      continue;
+
+    std::vector<unsigned char> data(len);
+    for (size_t i = 0; i < len; i++) data[i] = (i * 31 + 7) & 0xff;
+    Checksum::Kind k = strcmp(kind, "crc32c") == 0 ? Checksum::CRC32C
+                                                   : Checksum::XXH64;
+
+    Checksum whole(k, seed);
+    whole.update(data.data(), len);
+    Checksum pieces(k, seed);
+    for (size_t at = 0; at < len; ) {
+      size_t n = 1 + rand() % 70;
+      if (n > len - at) n = len - at;
+      pieces.update(data.data() + at, n);
+      at += n;
+    }
+
+    checked++;
+    if (whole.digest() != want || pieces.digest() != want) {
+      printf("%s seed %llu len %zu: got %016llx / %016llx, want %016llx\n",
+             kind, seed, len, (unsigned long long)whole.digest(),
+             (unsigned long long)pieces.digest(), want);
+      failed++;
+    }
+  }
+  fclose(in);
+
+  printf("%d of %d checksums wrong\n", failed, checked);
+  return failed > 0 || checked == 0;
+}
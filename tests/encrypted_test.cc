@@ -0,0 +1,131 @@
+//
+// encrypted_test.cc
+//
+// EncryptedBackend: data written through it reads back, including
+// after appending and through a write-only File, while a file cut
+// short at any record boundary, or with a byte changed, fails to read
+// with EBADMSG.  Built and run by "make test".
+//
+
+
+#include "encrypted_backend.h"
+#include "file.h"
+#include "test_util.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+
+
+static char name[] = "/tmp/encrypted_testXXXXXX";
+static const uint8_t key[chacha20poly1305::key_size] = {1, 2, 3, 4, 5};
+static const size_t recordSize = EncryptedBackend::chunk_size +
+                                 chacha20poly1305::nonce_size +
+                                 chacha20poly1305::tag_size;
+
+
+static std::string text(size_t n) {
+  std::string s(n, 0);
+  for (size_t i = 0; i < n; i++) s[i] = 'a' + rand() % 26;
+  return s;
+}
+
+
+// Append data to the encrypted file, flushing after every flushEvery
+// bytes (and when closed).
+static void append(const std::string &data, size_t flushEvery) {
+  File f(name, "r+");
+  f.setBackend(new EncryptedBackend(f.fileno(), key));
+  f.fseek(0, File::seek_end);
+  for (size_t at = 0; at < data.size(); at += flushEvery) {
+    size_t n = data.size() - at;
+    if (n > flushEvery) n = flushEvery;
+    f.fwrite(data.data() + at, 1, n);
+    f.fflush();
+  }
+}
+
+
+// Read the encrypted file back into *data; false if the read fails.
+static bool readBack(std::string *data, int *error) {
+  File f(name, "r");
+  f.setBackend(new EncryptedBackend(f.fileno(), key));
+  data->clear();
+  char buf[5000];
+  size_t n;
+  errno = 0;
+  while ((n = f.fread(buf, 1, sizeof(buf))) > 0 && n != (size_t)File::eof)
+    data->append(buf, n);
+  *error = errno;
+  return f.ferror() == 0;
+}
+
+
+// Write want in pieces, check it reads back, then check that cutting
+// the file at each record boundary is detected.
+static void writeAndCut(const char *what, const std::string &want,
+                        size_t piece, size_t flushEvery) {
+  spit(name, "");
+  for (size_t at = 0; at < want.size(); at += piece)
+    append(want.substr(at, piece), flushEvery);
+  where = what;
+  std::string got;
+  int error;
+  check(readBack(&got, &error) && got == want, "reads back");
+
+  std::string whole = slurp(name);
+  for (size_t cut = recordSize; cut < whole.size(); cut += recordSize) {
+    spit(name, whole.substr(0, cut));
+    check(!readBack(&got, &error) && error == EBADMSG,
+          "cut at a record boundary is detected");
+    check(got.size() < cut / recordSize * EncryptedBackend::chunk_size,
+          "nothing from the cut record is returned");
+  }
+  where = "";
+}
+
+
+int main() {
+  scratchFile(name);
+  srand(1);
+  const size_t chunk = EncryptedBackend::chunk_size;
+
+  writeAndCut("one write", text(3 * chunk + 100), 1 << 20, 1 << 20);
+  writeAndCut("whole records", text(3 * chunk), 1 << 20, 1 << 20);
+  writeAndCut("appends", text(5 * chunk + 7), chunk / 2 + 3, chunk / 3);
+  writeAndCut("appends of whole records", text(4 * chunk), chunk, chunk);
+
+  // Whole records written through a write-only File: marking the last
+  // record mustn't need to read it back
+  {
+    std::string want = text(2 * chunk);
+    spit(name, "");
+    {
+      File f(name, "w");
+      f.setBackend(new EncryptedBackend(f.fileno(), key));
+      // In halves, so that File's buffer hands over whole records
+      for (size_t at = 0; at < want.size(); at += chunk / 2)
+        f.fwrite(want.data() + at, 1, chunk / 2);
+      check(f.fflush() == 0, "write-only flush");
+    }
+    std::string got;
+    int error;
+    check(readBack(&got, &error) && got == want, "write-only reads back");
+  }
+
+  // A changed byte fails to authenticate
+  std::string want = text(2 * chunk + 10);
+  spit(name, "");
+  append(want, want.size());
+  std::string whole = slurp(name);
+  whole[recordSize + 20] ^= 1;
+  spit(name, whole);
+  std::string got;
+  int error;
+  check(!readBack(&got, &error) && error == EBADMSG, "changed byte detected");
+  check(got == want.substr(0, chunk), "records before it read back");
+
+  return finish("encrypted_test", name);
+}
@@ -0,0 +1,329 @@
+//
+// fault_test.cc
+//
+// Differential test of File against an in-memory model, under faults
+// injected with FaultBackend, and against stdio without them.  Built
+// and run by "make test"; the number of seeds (default 40) can be
+// given as an argument.
+//
+// Five parts:
+//  - Random reads, writes, fgets, fgetc, fputc, fprintf, seeks and
+//    ftells on an "r+" File with random buffering, while short reads
+//    and writes and EINTR are injected.  None of those may change any
+//    result, so every read and the final file must match the model.
+//  - Sequential writes while writes also fail outright (ENOSPC, EIO).
+//    The model keeps only what fwrite says it accepted; once the faults
+//    stop, fflush must leave exactly that in the file.
+//  - The scripted case of a short write followed by ENOSPC.
+//  - Unbuffered fprintf making one write per call, even when its
+//    output is bigger than the buffer.
+//  - The random operations again, on a File and on a stdio FILE over
+//    copies of the same file.  Faults can't be injected under stdio,
+//    so the model is what checks the fault handling; this checks that
+//    the model, and so File, agrees with stdio on every result.
+//
+
+
+#include "fault_backend.h"
+#include "file.h"
+#include "test_util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+
+static char name[] = "/tmp/fault_testXXXXXX";
+static char stdioName[] = "/tmp/fault_test_stdioXXXXXX";
+
+
+static void empty() {
+  if (truncate(name, 0) != 0) perror("truncate");
+}
+
+
+// A File on name, with its writes and reads going through a new
+// FaultBackend (returned in *fb) and random buffering.
+static File *openFaulty(const char *mode, FaultBackend **fb) {
+  File *f = new File(name, mode);
+  int bmode = rand() % 4;
+  if (bmode == 1) f->setvbuf(NULL, File::LINE_BUFFER, 100 + rand() % 9000);
+  if (bmode == 2) f->setvbuf(NULL, File::NO_BUFFER, 0);
+  if (bmode == 3) f->setvbuf(NULL, File::FULL_BUFFER, 1 + rand() % 500);
+  *fb = new FaultBackend(f->fileno());
+  f->setBackend(*fb);
+  return f;
+}
+
+
+static std::string text(size_t n) {
+  std::string s(n, 0);
+  for (size_t i = 0; i < n; i++)
+    s[i] = (rand() % 10 == 0) ? '\n' : 'a' + rand() % 26;
+  return s;
+}
+
+
+// Random operations that the faults must not change.
+static bool randomOps(int seed) {
+  srand(seed);
+  empty();
+  FaultBackend *fb;
+  File *f = openFaulty("r+", &fb);
+  fb->randomize(seed, 3, FaultBackend::short_io | FaultBackend::interrupted);
+  std::string model;
+  size_t pos = 0;
+
+  for (int it = 0; it < 3000; it++) {
+    int op = rand() % 14;
+    size_t big = (rand() % 5 == 0) ? 20000 : 200;
+    if (op < 4) {
+      std::string d = text(rand() % big);
+      if (f->fwrite(d.data(), 1, d.size()) != d.size()) goto wrong;
+      if (model.size() < pos + d.size()) model.resize(pos + d.size());
+      model.replace(pos, d.size(), d);
+      pos += d.size();
+    } else if (op < 7) {
+      size_t n = rand() % big;
+      std::vector<char> d(n + 1);
+      size_t want = std::min(n, model.size() - pos);
+      size_t n2 = f->fread(d.data(), 1, n);
+      if (n2 != want || model.compare(pos, want, d.data(), want) != 0)
+        goto wrong;
+      pos += want;
+    } else if (op < 9) {
+      int size = 2 + rand() % 300;
+      std::vector<char> d(size);
+      size_t want = std::min((size_t)size - 1, model.size() - pos);
+      size_t nl = model.find('\n', pos);
+      if (nl != std::string::npos && nl < pos + want) want = nl + 1 - pos;
+      char *r = f->fgets(d.data(), size);
+      if (want == 0 ? r != NULL
+                    : (r == NULL || model.compare(pos, want, r) != 0))
+        goto wrong;
+      pos += want;
+    } else if (op < 10) {
+      int want = (pos < model.size()) ? (unsigned char)model[pos++]
+                                      : File::eof;
+      if (f->fgetc() != want) goto wrong;
+    } else if (op < 11) {
+      int c = 'A' + rand() % 26;
+      if (f->fputc(c) != c) goto wrong;
+      if (model.size() < pos + 1) model.resize(pos + 1);
+      model[pos++] = c;
+    } else if (op < 12) {
+      long to = rand() % (model.size() + 1);
+      int whence = rand() % 3;
+      long offset = to;
+      if (whence == File::seek_cur) offset = to - (long)pos;
+      if (whence == File::seek_end) offset = to - (long)model.size();
+      if (f->fseek(offset, (File::Whence)whence) != 0) goto wrong;
+      pos = to;
+    } else if (op < 13) {
+      if (f->ftell() != (long)pos) goto wrong;
+    } else {
+      char b[32];
+      int n = snprintf(b, sizeof(b), "%d:%s\n", it, "xy");
+      f->fprintf("%d:%s\n", it, "xy");
+      if (model.size() < pos + n) model.resize(pos + n);
+      model.replace(pos, n, b, n);
+      pos += n;
+    }
+    continue;
+  wrong:
+    printf("seed %d: op %d at step %d differs from the model\n", seed, op,
+           it);
+    delete f;
+    return false;
+  }
+
+  bool ok = f->fflush() == 0 && f->ferror() == 0;
+  delete f;
+  if (!ok || slurp(name) != model) {
+    printf("seed %d: file differs from the model\n", seed);
+    return false;
+  }
+  return true;
+}
+
+
+// Sequential writes that may fail; nothing may be lost or repeated.
+static bool failingWrites(int seed) {
+  srand(seed);
+  empty();
+  FaultBackend *fb;
+  File *f = openFaulty("w", &fb);
+  fb->randomize(seed, 4, FaultBackend::short_io | FaultBackend::no_space |
+                         FaultBackend::io_error);
+  std::string model;
+  for (int it = 0; it < 2000; it++) {
+    std::string d = text((rand() % 5 == 0) ? rand() % 20000 : rand() % 200);
+    size_t n = f->fwrite(d.data(), 1, d.size());
+    if (n == (size_t)File::eof) continue;	// None of it was taken
+    if (n > d.size()) {
+      printf("seed %d: fwrite took %zu of %zu bytes\n", seed, n, d.size());
+      delete f;
+      return false;
+    }
+    model.append(d, 0, n);
+  }
+  fb->randomize(0, 0, 0);
+  bool ok = f->fflush() == 0;
+  delete f;
+  if (!ok || slurp(name) != model) {
+    printf("seed %d: failed writes lost or repeated data\n", seed);
+    return false;
+  }
+  return true;
+}
+
+
+// A short write of the buffer, then ENOSPC: the half that went out
+// must not be written again.
+static bool shortThenFull() {
+  empty();
+  File f(name, "w");
+  f.setvbuf(NULL, File::FULL_BUFFER, 64);
+  FaultBackend *fb = new FaultBackend(f.fileno());
+  fb->inject(FaultBackend::WRITE, 0, FaultBackend::short_io);
+  fb->inject(FaultBackend::WRITE, 1, FaultBackend::no_space);
+  f.setBackend(fb);
+  std::string a(60, 'a');
+  bool ok = f.fwrite(a.data(), 1, 60) == 60 &&
+            f.fwrite(a.data(), 1, 40) == (size_t)File::eof &&
+            f.ferror() != 0 && f.fflush() == 0;
+  if (!ok || slurp(name) != a) {
+    printf("short write then ENOSPC: wrote %zu bytes for 60\n",
+           slurp(name).size());
+    return false;
+  }
+  return true;
+}
+
+
+// Unbuffered, fprintf output goes out in one write, however big.
+static bool unbufferedPrintf() {
+  empty();
+  File f(name, "w");
+  f.setvbuf(NULL, File::NO_BUFFER, 0);
+  FaultBackend *fb = new FaultBackend(f.fileno());
+  f.setBackend(fb);
+  std::string big(10000, 's');
+  std::string want = "<" + big + ">\n";
+  bool ok = f.fprintf("<%s>\n", big.c_str()) == (int)want.size() &&
+            fb->calls(FaultBackend::WRITE) == 1;
+  // A format longer than the buffer: many one-character pieces
+  std::string dots(10000, '.');
+  ok = ok && f.fprintf((dots + "%d").c_str(), 42) == 10002 &&
+       fb->calls(FaultBackend::WRITE) == 2;
+  want += dots + "42";
+  if (!ok || slurp(name) != want) {
+    printf("unbuffered fprintf: %lu writes\n",
+           fb->calls(FaultBackend::WRITE));
+    return false;
+  }
+  return true;
+}
+
+
+// Random operations on a File and on stdio, which must agree.  stdio
+// needs a seek between reading and writing; File doesn't, so only the
+// stdio side gets one.
+static bool againstStdio(int seed) {
+  srand(seed);
+  std::string start = text(rand() % 30000);
+  spit(name, start);
+  spit(stdioName, start);
+  FaultBackend *fb;
+  File *f = openFaulty("r+", &fb);
+  FILE *s = fopen(stdioName, "r+");
+  char last = '0';
+
+  for (int it = 0; it < 3000; it++) {
+    int op = rand() % 14;
+    size_t big = (rand() % 5 == 0) ? 20000 : 200;
+    bool reading = (op >= 4 && op < 10);
+    bool writing = (op < 4 || op == 10 || op == 13);
+    if ((reading && last == 'w') || (writing && last == 'r'))
+      fseek(s, 0, SEEK_CUR);
+    if (reading) last = 'r';
+    if (writing) last = 'w';
+    bool same;
+    if (op < 4) {
+      std::string d = text(rand() % big);
+      same = f->fwrite(d.data(), 1, d.size()) ==
+             fwrite(d.data(), 1, d.size(), s);
+    } else if (op < 7) {
+      size_t n = rand() % big;
+      std::vector<char> a(n + 1), b(n + 1);
+      size_t got = f->fread(a.data(), 1, n);
+      same = got == fread(b.data(), 1, n, s) &&
+             memcmp(a.data(), b.data(), std::min(got, n)) == 0;
+    } else if (op < 9) {
+      int size = 2 + rand() % 300;
+      std::vector<char> a(size), b(size);
+      char *ra = f->fgets(a.data(), size);
+      char *rb = fgets(b.data(), size, s);
+      same = (ra == NULL) == (rb == NULL) &&
+             (ra == NULL || strcmp(ra, rb) == 0);
+    } else if (op < 10) {
+      same = f->fgetc() == fgetc(s);
+    } else if (op < 11) {
+      int c = 'A' + rand() % 26;
+      same = f->fputc(c) == fputc(c, s);
+    } else if (op < 12) {
+      // Anywhere up to a little past the end, or before the start
+      int whence = rand() % 3;
+      long offset = rand() % 40000;
+      if (whence == File::seek_cur) offset -= ftell(s);
+      if (whence == File::seek_end) offset = -(long)(rand() % 1000);
+      int w = (whence == File::seek_set) ? SEEK_SET
+            : (whence == File::seek_cur) ? SEEK_CUR : SEEK_END;
+      same = (f->fseek(offset, (File::Whence)whence) == 0) ==
+             (fseek(s, offset, w) == 0);
+      last = '0';
+    } else if (op < 13) {
+      same = f->ftell() == ftell(s);
+    } else {
+      same = f->fprintf("%d:%s\n", it, "xy") == ::fprintf(s, "%d:%s\n", it,
+                                                         "xy");
+    }
+    if (!same) {
+      printf("seed %d: op %d at step %d differs from stdio\n", seed, op, it);
+      delete f;
+      fclose(s);
+      return false;
+    }
+  }
+
+  bool ok = f->fflush() == 0 && f->ferror() == 0;
+  delete f;
+  fclose(s);
+  if (!ok || slurp(name) != slurp(stdioName)) {
+    printf("seed %d: file differs from stdio's\n", seed);
+    return false;
+  }
+  return true;
+}
+
+
+int main(int argc, char **argv) {
+  int seeds = (argc > 1) ? atoi(argv[1]) : 40;
+  scratchFile(name);
+  scratchFile(stdioName);
+
+  for (int seed = 1; seed <= seeds; seed++) {
+    if (!randomOps(seed)) failed++;
+    if (!failingWrites(seed)) failed++;
+    if (!againstStdio(seed)) failed++;
+  }
+  if (!shortThenFull()) failed++;
+  if (!unbufferedPrintf()) failed++;
+
+  unlink(stdioName);
+  return finish("fault_test", name);
+}
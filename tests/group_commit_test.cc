@@ -0,0 +1,87 @@
+//
+// group_commit_test.cc
+//
+// GroupCommit: many threads each appending to their own File and
+// committing after every record, and agreement with File::sync and
+// File::datasync on Files with no descriptor or that can't be synced.
+// Built and run by "make test".
+//
+
+
+#include "file.h"
+#include "group_commit.h"
+#include "memory_backend.h"
+#include "test_util.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+int main() {
+  GroupCommit gc(std::chrono::microseconds(200));
+
+  // Threads committing records concurrently
+  const int threads = 8;
+  const int records = 50;
+  std::vector<std::string> names;
+  for (int t = 0; t < threads; t++) {
+    char name[] = "/tmp/group_commit_testXXXXXX";
+    scratchFile(name);
+    names.push_back(name);
+  }
+  std::vector<int> failures(threads, 0);
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; t++) {
+    workers.emplace_back([&, t] {
+      File f(names[t].c_str(), "w");
+      for (int i = 0; i < records; i++) {
+        f.fprintf("thread %d record %d\n", t, i);
+        if (gc.sync(f) != 0) failures[t]++;
+      }
+    });
+  }
+  for (std::thread &w : workers) w.join();
+  for (int t = 0; t < threads; t++) {
+    std::string want;
+    char line[64];
+    for (int i = 0; i < records; i++) {
+      snprintf(line, sizeof(line), "thread %d record %d\n", t, i);
+      want += line;
+    }
+    check(failures[t] == 0, "every commit succeeds");
+    check(slurp(names[t].c_str()) == want, "every record written");
+    unlink(names[t].c_str());
+  }
+
+  // No descriptor: nothing to sync, as File::sync says
+  {
+    File f(new MemoryBackend(), "w");
+    f.fputs("in memory\n");
+    check(f.sync() == 0 && f.datasync() == 0, "File::sync in memory");
+    f.fputs("more\n");
+    check(gc.sync(f) == 0 && f.ferror() == 0, "GroupCommit in memory");
+  }
+
+  // A descriptor that can't be synced (a pipe): both fail, and leave
+  // the File in the same error state
+  int p[2];
+  check(pipe(p) == 0, "pipe");
+  char path[32];
+  snprintf(path, sizeof(path), "/proc/self/fd/%d", p[1]);
+  {
+    File a(path, "w");
+    File b(path, "w");
+    check(a.datasync() == File::eof, "File::datasync on a pipe fails");
+    check(gc.sync(b) == File::eof, "GroupCommit on a pipe fails");
+    check(a.ferror() != 0 && b.ferror() == a.ferror(),
+          "same error state either way");
+  }
+  close(p[0]);
+  close(p[1]);
+
+  return finish("group_commit_test", NULL);
+}
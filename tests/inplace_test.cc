@@ -0,0 +1,122 @@
+//
+// inplace_test.cc
+//
+// Reads, writes and seeks alternating within the buffer of an "r+"
+// File: writes that change the read buffer in place, a dirty range
+// still pending when the buffer is refilled, seeks inside a dirty
+// buffer, and ftell after an in-place write.  Each case runs on a named
+// file (written back with pwrite) and on a MemoryBackend (written back
+// by seeking).  Built and run by "make test".
+//
+
+
+#include "file.h"
+#include "memory_backend.h"
+#include "test_util.h"
+
+#include <string.h>
+#include <string>
+
+
+static char name[] = "/tmp/inplace_testXXXXXX";
+
+
+// A File over the 1000-byte original, on disk or in memory, with a
+// 64-byte buffer so that refills come often.
+struct Subject {
+  MemoryBackend *mem = NULL;
+  File *f;
+
+  Subject(bool inMemory, const std::string &original) {
+    if (inMemory) {
+      this->mem = new MemoryBackend(original);
+      this->f = new File(this->mem, "r+");
+    } else {
+      spit(name, original);
+      this->f = new File(name, "r+");
+    }
+    this->f->setvbuf(NULL, File::FULL_BUFFER, 64);
+  }
+  ~Subject() {
+    delete this->f;
+  }
+
+  // The file's contents once everything is flushed.
+  std::string contents() {
+    this->f->fflush();
+    return (this->mem == NULL) ? slurp(name) : this->mem->contents();
+  }
+};
+
+
+static void run(bool inMemory) {
+  where = inMemory ? "MemoryBackend" : "file";
+  std::string original;
+  for (int i = 0; i < 1000; i++) original += 'a' + i % 26;
+  std::string want = original;
+  char b[64];
+
+  // Dirty bytes still pending when the buffer is refilled
+  {
+    Subject s(inMemory, original);
+    File &f = *s.f;
+    check(f.fread(b, 1, 60) == 60, "read 60");
+    check(f.fseek(-10, File::seek_cur) == 0, "seek back 10");
+    check(f.fwrite("XXXXXXXXXX", 1, 10) == 10, "in-place write");
+    want.replace(50, 10, "XXXXXXXXXX");
+    check(f.ftell() == 60, "ftell after in-place write");
+    check(f.fread(b, 1, 20) == 20 &&
+          memcmp(b, original.data() + 60, 20) == 0,
+          "read across the refill");
+    check(f.ftell() == 80, "ftell after the refill");
+    check(s.contents() == want, "dirty bytes written back once, in place");
+  }
+
+  // Seeking inside a dirty buffer
+  want = original;
+  {
+    Subject s(inMemory, original);
+    File &f = *s.f;
+    check(f.fread(b, 1, 30) == 30, "read 30");
+    check(f.fseek(10, File::seek_set) == 0, "seek into the buffer");
+    check(f.fwrite("12345", 1, 5) == 5, "in-place write at 10");
+    check(f.fseek(-10, File::seek_cur) == 0, "seek back over it");
+    check(f.ftell() == 5, "ftell after seeking back");
+    check(f.fread(b, 1, 15) == 15 &&
+          memcmp(b, "fghij12345pqrst", 15) == 0,
+          "read sees the in-place write");
+    check(f.fseek(40, File::seek_set) == 0 && f.fwrite("Z", 1, 1) == 1,
+          "second in-place write");
+    check(f.ftell() == 41, "ftell after the second write");
+    want.replace(10, 5, "12345");
+    want.replace(40, 1, "Z");
+    check(s.contents() == want, "both writes land");
+  }
+
+  // In-place update of every record, as a record-at-a-time update loop
+  // does
+  want = original;
+  {
+    Subject s(inMemory, original);
+    File &f = *s.f;
+    bool ok = true;
+    for (long at = 0; at + 10 <= 1000; at += 10) {
+      char rec[10];
+      ok = ok && f.fread(rec, 1, 10) == 10 &&
+           f.fseek(-10, File::seek_cur) == 0;
+      rec[3] = '#';
+      ok = ok && f.fwrite(rec, 1, 10) == 10 && f.ftell() == at + 10;
+      want[at + 3] = '#';
+    }
+    check(ok, "read, seek back, rewrite each record");
+    check(s.contents() == want, "every record updated");
+  }
+}
+
+
+int main() {
+  scratchFile(name);
+  run(false);
+  run(true);
+  return finish("inplace_test", name);
+}
@@ -0,0 +1,70 @@
+//
+// newline_test.cc
+//
+// Text mode: CRLF read as LF and LF written as CRLF, and rewinding after
+// buffered reads.  Built and run by "make test".
+//
+
+
+#include "file.h"
+#include "newline_backend.h"
+#include "test_util.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+
+int main() {
+  char name[] = "/tmp/newline_testXXXXXX";
+  scratchFile(name);
+
+  // Write LF lines in text mode; the file gets CRLF
+  std::string want;
+  {
+    File f(name, "w");
+    check(f.setBackend(new NewlineBackend(f.fileno())) == 0,
+          "text mode for writing");
+    char line[32];
+    for (int i = 1; i <= 2000; i++) {
+      snprintf(line, sizeof(line), "L%d\n", i);
+      f.fputs(line);
+      want += line;
+      want.insert(want.size() - 1, "\r");
+    }
+  }
+  check(slurp(name) == want, "written lines end in CRLF");
+
+  // Read them back as LF, rewind after buffered reads, and read again
+  {
+    File f(name, "r");
+    check(f.setBackend(new NewlineBackend(f.fileno())) == 0,
+          "text mode for reading");
+    char line[32];
+    int n = 0;
+    while (f.fgets(line, sizeof(line)) != NULL) {
+      char expect[32];
+      snprintf(expect, sizeof(expect), "L%d\n", ++n);
+      if (strcmp(line, expect) != 0) break;
+    }
+    check(n == 2000 && f.feof(), "read every line as LF");
+
+    // Rewind from every point, with and without read-ahead left in
+    // the buffer
+    int bad = -1;
+    for (int k = 2000; k >= 0 && bad < 0; k--) {
+      if (f.fseek(0, File::seek_set) != 0) bad = k;
+      for (int i = 0; i < k && bad < 0; i++) f.fgets(line, sizeof(line));
+      if (f.fseek(0, File::seek_set) != 0 || f.ferror() != 0 ||
+          f.fgets(line, sizeof(line)) == NULL || strcmp(line, "L1\n") != 0)
+        bad = k;
+    }
+    if (bad >= 0) printf("rewinding after %d lines:\n", bad);
+    check(bad < 0, "first line after rewind");
+
+    // Only rewinding is possible; a failed seek says so
+    check(f.fseek(0, File::seek_end) != 0, "seek elsewhere fails");
+  }
+
+  return finish("newline_test", name);
+}
@@ -0,0 +1,95 @@
+//
+// page_cache_test.cc
+//
+// setPageCache: turning the cache on after buffered reads and
+// writes, and random reads and updates through it compared with the
+// same operations on a plain File.  Built and run by "make test".
+//
+
+
+#include "file.h"
+#include "page_cache_backend.h"
+#include "test_util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+
+static char name[] = "/tmp/page_cache_testXXXXXX";
+
+
+// Random record reads and updates on a File over a file of 64-byte
+// records, switching the page size halfway if cached.
+static std::string randomUpdates(bool cached) {
+  std::string original;
+  for (int i = 0; i < 20000; i++) {
+    char rec[65];
+    snprintf(rec, sizeof(rec), "%063d\n", i);
+    original += rec;
+  }
+  spit(name, original);
+  {
+    File f(name, "r+");
+    if (cached) {
+      setPageCache(f, 4096, 8);
+      f.setvbuf(NULL, File::FULL_BUFFER, 128);
+    }
+    srand(1);
+    char r[64];
+    for (int i = 0; i < 20000; i++) {
+      long at = (rand() % 20000) * 64L;
+      if (f.fseek(at, File::seek_set) != 0 || f.fread(r, 1, 64) != 64)
+        return std::string();
+      if (rand() % 3 == 0) {
+        r[i % 63] = 'a' + i % 26;
+        f.fseek(at, File::seek_set);
+        f.fwrite(r, 1, 64);
+      }
+      if (cached && i == 10000 && setPageCache(f, 16384, 4) != 0)
+        return std::string();
+    }
+  }
+  return slurp(name);
+}
+
+
+int main() {
+  scratchFile(name);
+
+  std::string digits;
+  for (int i = 0; i < 20000; i++) digits += '0' + i % 10;
+
+  // After a buffered read, the cache picks up at the File's position,
+  // not at the end of the read-ahead
+  spit(name, digits);
+  {
+    File f(name, "r");
+    char b[10];
+    check(f.fread(b, 1, 10) == 10, "read before the cache");
+    check(setPageCache(f, 4096, 4) == 0, "setPageCache after a read");
+    check(f.ftell() == 10, "ftell after setPageCache");
+    check(f.fread(b, 1, 10) == 10 && memcmp(b, "0123456789", 10) == 0,
+          "read continues at offset 10");
+  }
+
+  // Buffered writes go out before the cache reads the file's size
+  spit(name, "");
+  {
+    File f(name, "w+");
+    check(f.fwrite("hello", 1, 5) == 5, "write before the cache");
+    check(setPageCache(f, 4096, 4) == 0, "setPageCache after a write");
+    char b[8];
+    check(f.fseek(0, File::seek_set) == 0 && f.fread(b, 1, 8) == 5 &&
+          memcmp(b, "hello", 5) == 0,
+          "read back what was written before the cache");
+  }
+  check(slurp(name) == "hello", "file after setPageCache");
+
+  std::string plain = randomUpdates(false);
+  check(!plain.empty() && randomUpdates(true) == plain,
+        "random updates through the cache");
+
+  return finish("page_cache_test", name);
+}
@@ -0,0 +1,75 @@
+//
+// test_util.h
+//
+// Scaffolding shared by the tests in this directory: counting failed
+// checks, and reading and writing a scratch file whole.
+//
+
+#if !defined(TEST_UTIL_H)
+#define TEST_UTIL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+
+
+// Number of failed checks; finish() turns it into the exit status.
+static int failed = 0;
+
+// Names the case being run, for failure messages ("" if unused).
+static const char *where = "";
+
+
+inline void check(bool ok, const char *what) {
+  if (!ok) {
+    if (where[0] != '\0') printf("FAIL (%s): %s\n", where, what);
+    else printf("FAIL: %s\n", what);
+    failed++;
+  }
+}
+
+
+// Make an empty file from a mkstemp template such as
+// "/tmp/x_testXXXXXX", which is filled in with its name.  Exits if
+// that fails.
+inline void scratchFile(char *name) {
+  int fd = mkstemp(name);
+  if (fd < 0) {
+    perror("mkstemp");
+    exit(1);
+  }
+  close(fd);
+}
+
+
+// The whole contents of the named file.
+inline std::string slurp(const char *name) {
+  std::string s;
+  FILE *f = fopen(name, "rb");
+  if (f == NULL) return s;
+  char b[4096];
+  size_t n;
+  while ((n = fread(b, 1, sizeof(b), f)) > 0) s.append(b, n);
+  fclose(f);
+  return s;
+}
+
+
+// Replace the contents of the named file with s.
+inline void spit(const char *name, const std::string &s) {
+  FILE *f = fopen(name, "wb");
+  fwrite(s.data(), 1, s.size(), f);
+  fclose(f);
+}
+
+
+// Remove the scratch file, report, and return main's exit status.
+inline int finish(const char *test, const char *name) {
+  if (name != NULL) unlink(name);
+  if (failed == 0) printf("%s passed\n", test);
+  return failed > 0;
+}
+
+
+#endif
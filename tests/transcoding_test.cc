@@ -0,0 +1,88 @@
+//
+// transcoding_test.cc
+//
+// TranscodingBackend: UTF-16LE and Latin-1 files read and written as
+// UTF-8, and rewinding after buffered reads.
+// Built and run by "make test".
+//
+
+
+#include "file.h"
+#include "test_util.h"
+#include "transcoding_backend.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+
+
+// Read the whole File in pieces of varying size.
+static std::string readAll(File &f) {
+  std::string s;
+  char b[5000];
+  for (int i = 0; ; i++) {
+    size_t n = f.fread(b, 1, 1 + (i * 977) % sizeof(b));
+    if (n == 0 || n == (size_t)File::eof) break;
+    s.append(b, n);
+  }
+  return s;
+}
+
+
+int main() {
+  char name[] = "/tmp/transcoding_testXXXXXX";
+  scratchFile(name);
+
+  // Latin-1: "\xe9x" then enough 'x's to need several refills
+  std::string latin1 = "\xe9x" + std::string(100000, 'x');
+  std::string utf8 = "\xc3\xa9x" + std::string(100000, 'x');
+  spit(name, latin1);
+  {
+    File f(name, "r");
+    f.setBackend(new TranscodingBackend(f.fileno(),
+                                        TranscodingBackend::LATIN1));
+    check(readAll(f) == utf8, "Latin-1 read as UTF-8");
+
+    // Rewind after buffered reads of every size up to a few buffers
+    int bad = -1;
+    char b[3];
+    for (size_t k = 0; k < 3 * File::bufsiz && bad < 0; k += 7) {
+      std::string skip(k, 0);
+      if (f.fseek(0, File::seek_set) != 0 ||
+          (k > 0 && f.fread(&skip[0], 1, k) != k) ||
+          f.fseek(0, File::seek_set) != 0 || f.ferror() != 0 ||
+          f.fread(b, 1, 3) != 3 || memcmp(b, "\xc3\xa9x", 3) != 0)
+        bad = (int)k;
+    }
+    if (bad >= 0) printf("rewinding after %d bytes:\n", bad);
+    check(bad < 0, "first bytes after rewind");
+  }
+
+  // UTF-16LE, including a surrogate pair, both ways
+  std::string text;
+  for (int i = 0; i < 3000; i++)
+    text += "a\xc3\xa9\xe6\x97\xa5\xf0\x9f\x98\x80\n";
+  std::string utf16;
+  for (int i = 0; i < 3000; i++)
+    utf16 += std::string("a\0\xe9\0\xe5\x65\x3d\xd8\x00\xde\n\0", 12);
+  spit(name, "");		// "w" doesn't truncate
+  {
+    File f(name, "w");
+    f.setBackend(new TranscodingBackend(f.fileno(),
+                                        TranscodingBackend::UTF16LE));
+    for (size_t at = 0; at < text.size(); at += 333)
+      f.fwrite(text.data() + at, 1, std::min((size_t)333, text.size() - at));
+  }
+  check(slurp(name) == utf16, "UTF-8 written as UTF-16LE");
+  {
+    File f(name, "r");
+    f.setBackend(new TranscodingBackend(f.fileno(),
+                                        TranscodingBackend::UTF16LE));
+    check(readAll(f) == text, "UTF-16LE read as UTF-8");
+    check(f.fseek(0, File::seek_set) == 0 && readAll(f) == text,
+          "UTF-16LE read again after rewind");
+  }
+
+  return finish("transcoding_test", name);
+}
@@ -0,0 +1,331 @@
+//
+// transcoding_backend.cc
+//
+// A Backend that stores text in UTF-16LE or Latin-1 while the File
+// reads and writes UTF-8.
+//
+
+
+#include "transcoding_backend.h"
+#include "utf8.h"
+
+#include <unistd.h>	// read, write, lseek
+#include <stdlib.h>	// malloc, free
+#include <string.h>	// memcpy, memmove
+#include <errno.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+
+static const uint32_t REPLACEMENT = 0xfffd;
+
+
+// Each kernel converts in[0..n) into out and returns the number of
+// bytes produced, setting *used to the input consumed.  Unless final,
+// an incomplete character at the end is left unconsumed.
+
+static size_t latin1ToUtf8(const unsigned char *in, size_t n, char *out,
+                           size_t *used) {
+  char *o = out;
+  size_t i = 0;
+  while (i < n) {
+#if defined(__SSE2__)
+    if (i + 16 <= n) {
+      __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+      if (_mm_movemask_epi8(v) == 0) {
+        _mm_storeu_si128((__m128i *)o, v);
+        i += 16;
+        o += 16;
+        continue;
+      }
+    }
+#endif
+    unsigned char c = in[i++];
+    if (c < 0x80) {
+      *o++ = (char)c;
+    } else {
+      *o++ = (char)(0xc0 | (c >> 6));
+      *o++ = (char)(0x80 | (c & 0x3f));
+    }
+  }
+  *used = n;
+  return o - out;
+}
+
+
+static size_t utf16ToUtf8(const unsigned char *in, size_t n, char *out,
+                          size_t *used, bool final) {
+  char *o = out;
+  size_t i = 0;
+  while (i + 2 <= n) {
+#if defined(__SSE2__)
+    if (i + 16 <= n) {
+      // Eight ASCII code units narrow to eight bytes
+      __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+      __m128i high = _mm_and_si128(v, _mm_set1_epi16((short)0xff80));
+      if (_mm_movemask_epi8(_mm_cmpeq_epi16(high, _mm_setzero_si128())) ==
+          0xffff) {
+        _mm_storel_epi64((__m128i *)o, _mm_packus_epi16(v, v));
+        i += 16;
+        o += 8;
+        continue;
+      }
+    }
+#endif
+    uint32_t u = in[i] | (in[i + 1] << 8);
+    size_t units = 1;
+    if (u >= 0xd800 && u <= 0xdbff) {
+      if (i + 4 > n) {
+        if (!final) break;		// The low half is still to come
+        i = n - 1;			// Cut short: one error for the rest
+        break;
+      }
+      uint32_t v = in[i + 2] | (in[i + 3] << 8);
+      if (v >= 0xdc00 && v <= 0xdfff) {
+        u = 0x10000 + ((u - 0xd800) << 10) + (v - 0xdc00);
+        units = 2;
+      } else {
+        u = REPLACEMENT;
+      }
+    } else if (u >= 0xdc00 && u <= 0xdfff) {
+      u = REPLACEMENT;
+    }
+    o += utf8Encode(u, o);
+    i += 2 * units;
+  }
+  if (final && i < n) {
+    o += utf8Encode(REPLACEMENT, o);	// A lone last byte, or surrogate
+    i = n;
+  }
+  *used = i;
+  return o - out;
+}
+
+
+static size_t utf8ToEncoding(const char *in, size_t n, char *out,
+                             size_t *used, bool final, bool latin1) {
+  char *o = out;
+  size_t i = 0;
+  while (i < n) {
+#if defined(__SSE2__)
+    if (i + 16 <= n) {
+      __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+      if (_mm_movemask_epi8(v) == 0) {
+        if (latin1) {
+          _mm_storeu_si128((__m128i *)o, v);
+          o += 16;
+        } else {
+          // Widen sixteen ASCII bytes to sixteen code units
+          __m128i zero = _mm_setzero_si128();
+          _mm_storeu_si128((__m128i *)o, _mm_unpacklo_epi8(v, zero));
+          _mm_storeu_si128((__m128i *)(o + 16), _mm_unpackhi_epi8(v, zero));
+          o += 32;
+        }
+        i += 16;
+        continue;
+      }
+    }
+#endif
+    uint32_t cp;
+    int len = utf8Decode(in + i, n - i, &cp);
+    if (len == 0) {
+      if (!final) break;		// The rest of it is still to come
+      len = -(int)(n - i);
+    }
+    if (len < 0) {
+      cp = REPLACEMENT;
+      len = -len;
+    }
+    i += len;
+    if (latin1) {
+      *o++ = (cp <= 0xff) ? (char)cp : '?';
+    } else if (cp < 0x10000) {
+      *o++ = (char)(cp & 0xff);
+      *o++ = (char)(cp >> 8);
+    } else {
+      uint32_t hi = 0xd800 + ((cp - 0x10000) >> 10);
+      uint32_t lo = 0xdc00 + ((cp - 0x10000) & 0x3ff);
+      *o++ = (char)(hi & 0xff);
+      *o++ = (char)(hi >> 8);
+      *o++ = (char)(lo & 0xff);
+      *o++ = (char)(lo >> 8);
+    }
+  }
+  *used = i;
+  return o - out;
+}
+
+
+TranscodingBackend::TranscodingBackend(int fd, Encoding encoding)
+  : fd(fd), encoding(encoding) {
+  this->raw = reinterpret_cast<char*>(malloc(raw_size));
+  // Room for any raw block, converted
+  this->text = reinterpret_cast<char*>(malloc(2 * raw_size + 4));
+}
+
+
+TranscodingBackend::~TranscodingBackend() {
+  if (this->lastAct == 'w') {
+    if (this->pendLen > 0 && this->drain() == 0) {
+      // A sequence that never got finished
+      size_t used;
+      this->rawLen = utf8ToEncoding(this->pend, this->pendLen, this->raw,
+                                    &used, true, this->encoding == LATIN1);
+    }
+    this->drain();
+  }
+  free(this->raw);
+  free(this->text);
+}
+
+
+// Convert the raw input held into out, which has room for all of it.
+ssize_t TranscodingBackend::decodeSome(char *out, size_t *produced) {
+  size_t used;
+  if (this->encoding == LATIN1)
+    *produced = latin1ToUtf8((const unsigned char *)this->raw, this->rawLen,
+                             out, &used);
+  else
+    *produced = utf16ToUtf8((const unsigned char *)this->raw, this->rawLen,
+                            out, &used, this->atEof);
+  memmove(this->raw, this->raw + used, this->rawLen - used);
+  this->rawLen -= used;
+  return used;
+}
+
+
+ssize_t TranscodingBackend::read(void *buf, size_t count) {
+  if (this->lastAct == 'w') {
+    errno = EBADF;
+    return -1;
+  }
+  this->lastAct = 'r';
+  if (count == 0) return 0;
+  for (;;) {
+    if (this->textAt < this->textEnd) {
+      size_t n = this->textEnd - this->textAt;
+      if (n > count) n = count;
+      memcpy(buf, this->text + this->textAt, n);
+      this->textAt += n;
+      this->pos += n;
+      return n;
+    }
+    if (this->atEof && this->rawLen == 0) return 0;
+    if (!this->atEof) {
+      ssize_t n = ::read(this->fd, this->raw + this->rawLen,
+                         raw_size - this->rawLen);
+      if (n < 0) return -1;
+      if (n == 0) this->atEof = true;
+      this->rawLen += n;
+    }
+    // Convert straight into buf when it is surely big enough
+    size_t produced;
+    if (count >= 2 * this->rawLen + 4) {
+      this->decodeSome((char *)buf, &produced);
+      if (produced > 0) {
+        this->pos += produced;
+        return produced;
+      }
+    } else {
+      this->decodeSome(this->text, &produced);
+      this->textAt = 0;
+      this->textEnd = produced;
+    }
+  }
+}
+
+
+// Write out the encoded output held.
+int TranscodingBackend::drain() {
+  while (this->rawAt < this->rawLen) {
+    ssize_t n = ::write(this->fd, this->raw + this->rawAt,
+                        this->rawLen - this->rawAt);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    this->rawAt += n;
+  }
+  this->rawAt = 0;
+  this->rawLen = 0;
+  return 0;
+}
+
+
+ssize_t TranscodingBackend::write(const void *buf, size_t count) {
+  if (this->lastAct == 'r') {
+    errno = EBADF;
+    return -1;
+  }
+  this->lastAct = 'w';
+  if (this->drain() != 0) return -1;
+  const char *src = (const char *)buf;
+  bool latin1 = (this->encoding == LATIN1);
+  size_t used;
+  size_t done = 0;
+  // Finish a sequence split by the last write, a byte at a time
+  while (this->pendLen > 0 && done < count) {
+    this->pend[this->pendLen++] = src[done++];
+    uint32_t cp;
+    int len = utf8Decode(this->pend, this->pendLen, &cp);
+    if (len == 0) continue;
+    if (len < 0) {
+      this->pendLen--;		// src[done - 1] doesn't belong to it
+      done--;
+    }
+    this->rawLen = utf8ToEncoding(this->pend, this->pendLen, this->raw,
+                                  &used, true, latin1);
+    this->pendLen = 0;
+  }
+  while (done < count) {
+    // Leave room for everything to double in size
+    size_t piece = (raw_size - this->rawLen) / 2;
+    bool last = (piece >= count - done);
+    if (last) piece = count - done;
+    this->rawLen += utf8ToEncoding(src + done, piece,
+                                   this->raw + this->rawLen, &used, false,
+                                   latin1);
+    done += used;
+    if (last && used < piece) {
+      // Hold the start of a sequence that the next write will finish
+      this->pendLen = count - done;
+      memcpy(this->pend, src + done, this->pendLen);
+      done = count;
+    }
+    if (this->drain() != 0) break;
+  }
+  this->pos += done;
+  return (done > 0) ? (ssize_t)done : -1;
+}
+
+
+off_t TranscodingBackend::seek(off_t offset, int whence) {
+  if (offset == 0 && whence == SEEK_CUR) return this->pos;
+  if (offset != 0 || whence != SEEK_SET) {
+    errno = ESPIPE;
+    return -1;
+  }
+  if (this->flush() != 0 || lseek(this->fd, 0, SEEK_SET) == (off_t)-1)
+    return -1;
+  this->pos = 0;
+  this->lastAct = '0';
+  this->rawLen = 0;
+  this->textAt = 0;
+  this->textEnd = 0;
+  this->pendLen = 0;
+  this->atEof = false;
+  return 0;
+}
+
+
+int TranscodingBackend::flush() {
+  if (this->lastAct != 'w') return 0;
+  return this->drain();
+}
+
+
+int TranscodingBackend::sync(bool dataOnly) {
+  return syncFd(this->fd, dataOnly);
+}
@@ -0,0 +1,73 @@
+//
+// transcoding_backend.h
+//
+// A Backend that stores text in UTF-16LE or Latin-1 while the File
+// reads and writes UTF-8, e.g. to ingest UTF-16 exports or legacy
+// Latin-1 files with code that only knows UTF-8.
+//
+// Each refill reads a block of the underlying file and converts it in
+// one pass; each flush converts and writes the File's buffer.  ASCII
+// runs are converted 16 bytes at a time with SSE2.  A code unit or a
+// surrogate pair split across blocks, or a UTF-8 sequence split across
+// writes, is held back until the rest of it arrives.
+//
+// Malformed input never fails a read or write: it becomes U+FFFD (or
+// '?' when writing Latin-1, as does any character Latin-1 lacks).  A
+// byte order mark is passed through like any other character.
+//
+
+#if !defined(TRANSCODING_BACKEND_H)
+#define TRANSCODING_BACKEND_H
+
+#include "backend.h"
+
+
+class TranscodingBackend: public Backend {
+public:
+  enum Encoding {
+    UTF16LE,
+    LATIN1
+  };
+
+  // Transcode the file open on fd, which stays owned by the caller.  Use
+  // the File for reading or for writing, not both.
+  TranscodingBackend(int fd, Encoding encoding);
+  ~TranscodingBackend();
+
+  ssize_t read(void *buf, size_t count);
+  ssize_t write(const void *buf, size_t count);
+  // Only rewinding (seek(0, SEEK_SET)) and reporting the position in
+  // UTF-8 bytes (seek(0, SEEK_CUR)) are possible; otherwise ESPIPE.
+  off_t seek(off_t offset, int whence);
+  int sync(bool dataOnly);
+  // Write out converted data still held; a partial UTF-8 sequence
+  // stays held until the destructor.
+  int flush();
+
+private:
+  static const size_t raw_size = 16384;
+
+  int fd;
+  Encoding encoding;
+  off_t pos = 0;         // UTF-8 bytes read or written
+  char lastAct = '0';    // 'r' or 'w' once used
+  char *raw;             // Encoded bytes: read input or write output
+  size_t rawLen = 0;     // Read: unconverted input; write: unwritten
+  size_t rawAt = 0;      // Write: start of the unwritten output
+  char *text;            // Read: converted UTF-8 not yet returned
+  size_t textAt = 0;
+  size_t textEnd = 0;
+  char pend[4];          // Write: start of a split UTF-8 sequence
+  size_t pendLen = 0;
+  bool atEof = false;
+
+  ssize_t decodeSome(char *out, size_t *produced);
+  int drain();
+
+  // Disallow copy & assignment.
+  TranscodingBackend(TranscodingBackend const&) = delete;
+  TranscodingBackend& operator=(TranscodingBackend const&) = delete;
+};
+
+
+#endif
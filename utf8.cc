@@ -0,0 +1,209 @@
+//
+// utf8.cc
+//
+// UTF-8 decoding, encoding and validation.
+//
+
+
+#include "utf8.h"
+
+#if defined(__x86_64__)
+#include <tmmintrin.h>
+#endif
+
+
+int utf8Decode(const char *p, size_t n, uint32_t *cp) {
+  if (n == 0) return 0;
+  const unsigned char *s = (const unsigned char *)p;
+  uint32_t c = s[0];
+  if (c < 0x80) {
+    *cp = c;
+    return 1;
+  }
+  int len;
+  if (c < 0xc2) return -1;	// Continuation byte, or overlong lead
+  else if (c < 0xe0) len = 2;
+  else if (c < 0xf0) len = 3;
+  else if (c < 0xf5) len = 4;
+  else return -1;
+  // The second byte's range rules out overlongs, surrogates and values
+  // past U+10FFFF.
+  unsigned lo = 0x80, hi = 0xbf;
+  if (c == 0xe0) lo = 0xa0;
+  else if (c == 0xed) hi = 0x9f;
+  else if (c == 0xf0) lo = 0x90;
+  else if (c == 0xf4) hi = 0x8f;
+  c &= 0x7f >> len;
+  for (int i = 1; i < len; i++) {
+    if ((size_t)i >= n) return 0;
+    if (s[i] < lo || s[i] > hi) return -i;
+    c = (c << 6) | (s[i] & 0x3f);
+    lo = 0x80;
+    hi = 0xbf;
+  }
+  *cp = c;
+  return len;
+}
+
+
+int utf8Encode(uint32_t cp, char *out) {
+  if (cp < 0x80) {
+    out[0] = (char)cp;
+    return 1;
+  } else if (cp < 0x800) {
+    out[0] = (char)(0xc0 | (cp >> 6));
+    out[1] = (char)(0x80 | (cp & 0x3f));
+    return 2;
+  } else if (cp >= 0xd800 && cp <= 0xdfff) {
+    return 0;
+  } else if (cp < 0x10000) {
+    out[0] = (char)(0xe0 | (cp >> 12));
+    out[1] = (char)(0x80 | ((cp >> 6) & 0x3f));
+    out[2] = (char)(0x80 | (cp & 0x3f));
+    return 3;
+  } else if (cp <= 0x10ffff) {
+    out[0] = (char)(0xf0 | (cp >> 18));
+    out[1] = (char)(0x80 | ((cp >> 12) & 0x3f));
+    out[2] = (char)(0x80 | ((cp >> 6) & 0x3f));
+    out[3] = (char)(0x80 | (cp & 0x3f));
+    return 4;
+  }
+  return 0;
+}
+
+
+static size_t validSoft(const unsigned char *s, size_t n) {
+  size_t at = 0;
+  while (at < n) {
+    if (s[at] < 0x80) {
+      at++;
+      continue;
+    }
+    uint32_t cp;
+    int len = utf8Decode((const char *)s + at, n - at, &cp);
+    if (len <= 0) break;
+    at += len;
+  }
+  return at;
+}
+
+
+#if defined(__x86_64__)
+// Error bits for each pair of adjacent bytes, looked up from the high
+// nibble of the first, the low nibble of the first and the high nibble
+// of the second.  A pair is bad if a bit is set in all three.
+enum {
+  TOO_SHORT = 1 << 0,		// Lead not followed by a continuation
+  TOO_LONG = 1 << 1,		// ASCII followed by a continuation
+  OVERLONG_3 = 1 << 2,
+  TOO_LARGE = 1 << 3,
+  SURROGATE = 1 << 4,
+  OVERLONG_2 = 1 << 5,
+  TOO_LARGE_1000 = 1 << 6,
+  OVERLONG_4 = 1 << 6,
+  TWO_CONTS = 1 << 7,		// Continuation after continuation: checked
+				// separately against the lead's length
+  CARRY = TOO_SHORT | TOO_LONG | TWO_CONTS
+};
+
+__attribute__((target("ssse3")))
+static inline __m128i high(__m128i v) {
+  return _mm_and_si128(_mm_srli_epi16(v, 4), _mm_set1_epi8(0x0f));
+}
+
+__attribute__((target("ssse3")))
+static inline __m128i blockErrors(__m128i in, __m128i prev) {
+  const __m128i byte1High = _mm_setr_epi8(
+    TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+    TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+    TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+    TOO_SHORT | OVERLONG_2,
+    TOO_SHORT,
+    TOO_SHORT | OVERLONG_3 | SURROGATE,
+    TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4);
+  const __m128i byte1Low = _mm_setr_epi8(
+    CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+    CARRY | OVERLONG_2,
+    CARRY,
+    CARRY,
+    CARRY | TOO_LARGE,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000);
+  const __m128i byte2High = _mm_setr_epi8(
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 |
+      OVERLONG_4,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT);
+
+  __m128i prev1 = _mm_alignr_epi8(in, prev, 15);
+  __m128i special = _mm_and_si128(
+    _mm_and_si128(_mm_shuffle_epi8(byte1High, high(prev1)),
+                  _mm_shuffle_epi8(byte1Low,
+                                   _mm_and_si128(prev1, _mm_set1_epi8(0x0f)))),
+    _mm_shuffle_epi8(byte2High, high(in)));
+  // A continuation must follow the second and third bytes before a
+  // three- or four-byte lead; TWO_CONTS is set exactly there if valid.
+  __m128i prev2 = _mm_alignr_epi8(in, prev, 14);
+  __m128i prev3 = _mm_alignr_epi8(in, prev, 13);
+  __m128i must23 = _mm_or_si128(
+    _mm_subs_epu8(prev2, _mm_set1_epi8((char)(0xe0 - 0x80))),
+    _mm_subs_epu8(prev3, _mm_set1_epi8((char)(0xf0 - 0x80))));
+  __m128i must23at80 = _mm_and_si128(must23, _mm_set1_epi8((char)0x80));
+  return _mm_xor_si128(must23at80, special);
+}
+
+// Checks whole blocks until one has an error, then leaves the rest,
+// from the last character boundary before it, to validSoft.
+__attribute__((target("ssse3")))
+static size_t validHard(const unsigned char *s, size_t n) {
+  __m128i prev = _mm_setzero_si128();
+  size_t at = 0;
+  for (; at + 16 <= n; at += 16) {
+    __m128i in = _mm_loadu_si128((const __m128i *)(s + at));
+    if (_mm_movemask_epi8(in) == 0) {
+      // ASCII: fine unless the last block ended mid-sequence
+      const __m128i lastOk = _mm_setr_epi8(
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        (char)(0xf0 - 1), (char)(0xe0 - 1), (char)(0xc0 - 1));
+      if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_subs_epu8(prev, lastOk),
+                                           _mm_setzero_si128())) != 0xffff)
+        break;
+    } else {
+      __m128i e = blockErrors(in, prev);
+      if (_mm_movemask_epi8(_mm_cmpeq_epi8(e, _mm_setzero_si128())) !=
+          0xffff)
+        break;
+    }
+    prev = in;
+  }
+  // Everything before at is valid, except perhaps a sequence that
+  // starts in the last 3 bytes and runs on: go back to a boundary.
+  size_t from = (at > 3) ? at - 3 : 0;
+  while (from < at && (s[from] & 0xc0) == 0x80) from++;
+  return from + validSoft(s + from, n - from);
+}
+
+static const bool haveSsse3 = __builtin_cpu_supports("ssse3");
+#endif
+
+
+size_t utf8Valid(const char *p, size_t n) {
+#if defined(__x86_64__)
+  if (haveSsse3)
+    return validHard((const unsigned char *)p, n);
+#endif
+  return validSoft((const unsigned char *)p, n);
+}
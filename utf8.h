@@ -0,0 +1,33 @@
+//
+// utf8.h
+//
+// UTF-8 decoding, encoding and validation.  Validation follows the
+// lookup-table method of Keiser and Lemire ("Validating UTF-8 in less
+// than one instruction per byte"), 16 bytes at a time with SSSE3 when
+// the CPU has it.
+//
+
+#if !defined(UTF8_H)
+#define UTF8_H
+
+#include <cstddef>
+#include <stdint.h>
+
+
+// Decode the sequence at the start of p[0..n) into *cp and return its
+// length.  Return 0 if p[0..n) is the valid start of a longer sequence,
+// and -k if it is invalid: the first k bytes (at least 1) are the
+// largest part that could have begun a valid sequence, and should be
+// skipped as one error.
+int utf8Decode(const char *p, size_t n, uint32_t *cp);
+
+// Encode cp into out, which has room for 4 bytes, and return the length.
+// Return 0 if cp is a surrogate or above U+10FFFF.
+int utf8Encode(uint32_t cp, char *out);
+
+// Return the length of the longest prefix of p[0..n) that is valid
+// UTF-8 and ends on a character boundary: n if all of it is valid.
+size_t utf8Valid(const char *p, size_t n);
+
+
+#endif
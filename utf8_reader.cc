@@ -0,0 +1,110 @@
+//
+// utf8_reader.cc
+//
+// Read the lines of a File, validating them as UTF-8.
+//
+
+
+#include "utf8_reader.h"
+#include "file.h"
+#include "utf8.h"
+
+#include <stdlib.h>	// realloc, free
+#include <string.h>	// memchr, memmove
+
+
+Utf8Reader::Utf8Reader(File &file) : file(file) {
+  this->winStart = file.ftell();
+  if (this->winStart < 0) this->winStart = 0;  // A pipe, say
+}
+
+
+Utf8Reader::~Utf8Reader() {
+  free(this->win);
+}
+
+
+long Utf8Reader::offset() {
+  return this->lineStart;
+}
+
+
+const std::vector<long> &Utf8Reader::invalid() {
+  return this->bad;
+}
+
+
+int Utf8Reader::ferror() {
+  return this->err;
+}
+
+
+// Read another block onto the end of the window, first dropping the
+// lines already returned.  Return the number of bytes added, or -1.
+int Utf8Reader::extend() {
+  if (this->winAt > 0) {
+    memmove(this->win, this->win + this->winAt, this->winEnd - this->winAt);
+    this->winEnd -= this->winAt;
+    this->winStart += this->winAt;
+    this->winAt = 0;
+  }
+  if (this->winEnd + block_size > this->winCap) {
+    size_t cap = (this->winEnd + block_size) * 2;
+    char *grown = reinterpret_cast<char*>(realloc(this->win, cap));
+    if (grown == NULL) {
+      this->err = -1;
+      return -1;
+    }
+    this->win = grown;
+    this->winCap = cap;
+  }
+  size_t n = this->file.fread(this->win + this->winEnd, 1, block_size);
+  if (n == (size_t)File::eof || (n == 0 && this->file.ferror())) {
+    this->err = -2;
+    return -1;
+  }
+  this->winEnd += n;
+  return (int)n;
+}
+
+
+bool Utf8Reader::next(const char **line, size_t *len) {
+  this->bad.clear();
+  if (this->done) return false;
+  size_t searched = this->winAt;  // Bytes known to hold no newline
+  const char *nl;
+  for (;;) {
+    // Nothing to search (and no window at all, at first)
+    nl = (searched < this->winEnd)
+           ? (const char *)memchr(this->win + searched, '\n',
+                                  this->winEnd - searched)
+           : NULL;
+    if (nl != NULL) break;
+    searched = this->winEnd - this->winAt;
+    int n = this->extend();
+    if (n < 0) return false;
+    searched += this->winAt;
+    if (n == 0) {
+      this->done = true;	// A last line without a newline, if any
+      if (this->winAt == this->winEnd) return false;
+      break;
+    }
+  }
+  const char *p = this->win + this->winAt;
+  size_t n = (nl != NULL) ? nl + 1 - p : this->winEnd - this->winAt;
+  this->lineStart = this->winStart + this->winAt;
+
+  // Skip over each invalid sequence and carry on checking after it
+  size_t at = 0;
+  while ((at += utf8Valid(p + at, n - at)) < n) {
+    this->bad.push_back(this->lineStart + at);
+    uint32_t cp;
+    int k = utf8Decode(p + at, n - at, &cp);
+    at += (k < 0) ? -k : n - at;  // 0: cut short by the end of the line
+  }
+
+  *line = p;
+  *len = n;
+  this->winAt += n;
+  return true;
+}
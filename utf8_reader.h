@@ -0,0 +1,67 @@
+//
+// utf8_reader.h
+//
+// Read the lines of a File, checking that each is valid UTF-8 and
+// reporting where it isn't.
+//
+// The file is read in large blocks and each line is validated with
+// utf8Valid, which checks 16 bytes at a time, so clean text costs
+// little more than the copy into the window.  Lines are returned as
+// views into the reader's window, without copying; a view is valid
+// until the next call to next().
+//
+
+#if !defined(UTF8_READER_H)
+#define UTF8_READER_H
+
+#include <cstddef>
+#include <vector>
+
+class File;
+
+
+class Utf8Reader {
+public:
+  // Bytes read from the file at a time.  Larger than File's default
+  // buffer, so blocks are read straight into the window.
+  static const size_t block_size = 65536;
+
+  // Read file from its current position.  Offsets are file positions
+  // if the file can tell them (ftell), otherwise counted from there.
+  explicit Utf8Reader(File &file);
+  ~Utf8Reader();
+
+  // Set *line and *len to the next line, including its newline if it
+  // has one.  Invalid bytes are passed through as they are.  Return
+  // false at end of file, or on error (see ferror()).
+  bool next(const char **line, size_t *len);
+
+  // The offset of the last line returned, and of each invalid sequence
+  // in it, in order; empty if the line is valid UTF-8.  A sequence cut
+  // short by the end of the line is one invalid sequence.
+  long offset();
+  const std::vector<long> &invalid();
+
+  int ferror();
+
+private:
+  File &file;
+  char *win = NULL;      // File offsets [winStart, winStart + winEnd)
+  size_t winCap = 0;
+  size_t winAt = 0;      // Start of the next line in the window
+  size_t winEnd = 0;
+  long winStart = 0;
+  long lineStart = 0;
+  std::vector<long> bad;
+  bool done = false;
+  int err = 0;
+
+  int extend();
+
+  // Disallow copy & assignment.
+  Utf8Reader(Utf8Reader const&) = delete;
+  Utf8Reader& operator=(Utf8Reader const&) = delete;
+};
+
+
+#endif
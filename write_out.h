@@ -0,0 +1,67 @@
+//
+// write_out.h
+//
+// The write path shared by File and BasicFile: writing a buffer and
+// then the caller's data with as few system calls as possible, and
+// accounting for what got out when a write fails part way through.
+// Keeping one copy means a fix to either class reaches both.
+//
+
+#if !defined(WRITE_OUT_H)
+#define WRITE_OUT_H
+
+#include <errno.h>
+#include <string.h>	// memmove
+#include <sys/types.h>
+#include <sys/uio.h>	// struct iovec
+
+
+// Write a, then b, through writev (anything callable as writev(2) is,
+// without the descriptor), resuming after short writes and retrying
+// EINTR.  Sets *written to the number of bytes written, even on
+// failure.  Returns 0, or -1 with errno set.
+template <class Writev>
+int gatherWrite(Writev writev, const char *a, size_t alen, const char *b,
+                size_t blen, size_t *written) {
+  struct iovec iov[2];
+  iov[0].iov_base = (void *)a;
+  iov[0].iov_len = alen;
+  iov[1].iov_base = (void *)b;
+  iov[1].iov_len = blen;
+  int i = (alen == 0) ? 1 : 0;
+  *written = 0;
+  while (i < 2 && iov[i].iov_len > 0) {
+    ssize_t n = writev(iov + i, 2 - i);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    *written += n;
+    // Skip past whatever was written; a short write resumes mid-iovec.
+    while (i < 2 && (size_t)n >= iov[i].iov_len) {
+      n -= iov[i].iov_len;
+      i++;
+    }
+    if (i < 2) {
+      iov[i].iov_base = (char *)iov[i].iov_base + n;
+      iov[i].iov_len -= n;
+    }
+  }
+  return 0;
+}
+
+
+// After gatherWrite of the *bufAt bytes at buf followed by the caller's
+// data, with written bytes getting out: keep what didn't go out of the
+// buffer at its front, for the next flush, and return how many bytes of
+// the caller's data did go out.
+inline size_t keepUnwritten(char *buf, size_t *bufAt, size_t written) {
+  size_t sent = (written < *bufAt) ? written : *bufAt;
+  if (sent > 0 && sent < *bufAt)
+    memmove(buf, buf + sent, *bufAt - sent);
+  *bufAt -= sent;
+  return written - sent;
+}
+
+
+#endif